@@ -0,0 +1,205 @@
+/**
+    \file badsectorslog.cc
+    Implementation of the BadSectorsLog class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "badsectorslog.hh"
+#include "readstats.hh"
+
+#include <stdio.h>
+#include <signal.h>
+
+/// The signals that make the logs write out their queues
+static const int flushSignals[] = {SIGINT, SIGTERM, SIGHUP};
+
+/// The previous handlers of these signals
+static struct sigaction previousHandlers[3];
+
+/// The signal caught, if any
+static volatile sig_atomic_t caughtSignal = 0;
+
+/// Whether the handlers are installed
+static bool handlersInstalled = false;
+
+/// All the live logs, for writing them out when a signal is caught.
+/// The mutex also protects the handlers.
+static std::vector<BadSectorsLog *> allLogs;
+static std::mutex allLogsMutex;
+
+/// How often the threads check whether a signal was caught, in
+/// microseconds
+#define SIGNAL_POLL 100000
+
+BadSectorsLog::BadSectorsLog(const std::string & f, double d) :
+  fileName(f), file(NULL), queuedSince(0), added(0), written(0),
+  flushing(false), stopping(false), delay(d)
+{
+  {
+    std::lock_guard<std::mutex> lock(allLogsMutex);
+    if(allLogs.empty())
+      installHandlers();
+    allLogs.push_back(this);
+  }
+  thread = std::thread(&BadSectorsLog::loop, this);
+}
+
+BadSectorsLog::~BadSectorsLog()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+  {
+    std::lock_guard<std::mutex> lock(allLogsMutex);
+    for(int i = 0; i < allLogs.size(); i++)
+      if(allLogs[i] == this)
+        allLogs.erase(allLogs.begin() + i);
+    if(allLogs.empty())
+      restoreHandlers();
+  }
+  if(file)
+    fclose(file);
+}
+
+void BadSectorsLog::add(const BadSectors & range)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  added += 1;
+  if(queue.empty()) {
+    queuedSince = ReadStatistics::timestamp();
+    queue.push_back(range);
+  }
+  else if(! queue.back().tryMerge(range))
+    queue.push_back(range);
+}
+
+void BadSectorsLog::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  long target = added;
+  flushing = true;
+  wake.notify_one();
+  while(written < target)
+    done.wait(lock);
+  flushing = false;
+}
+
+void BadSectorsLog::writeQueue()
+{
+  std::vector<BadSectors> ranges;
+  long nb;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::swap(ranges, queue);
+    nb = added;
+  }
+  {
+    std::lock_guard<std::mutex> lock(fileMutex);
+    if(! ranges.empty()) {
+      if(! file)
+        file = fopen(fileName.c_str(), "a");
+      if(file) {
+        for(int i = 0; i < ranges.size(); i++)
+          fprintf(file, "%s\n", ranges[i].toString().c_str());
+        fflush(file);
+      }
+      else
+        fprintf(stderr, "\nCould not append %d bad sectors ranges to '%s': "
+                "%s\n", (int) ranges.size(), fileName.c_str(),
+                strerror(errno));
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if(nb > written)
+    written = nb;
+  done.notify_all();
+}
+
+void BadSectorsLog::loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    if(caughtSignal) {
+      lock.unlock();
+      handleSignal();
+      lock.lock();
+    }
+    bool due = ! queue.empty() &&
+      (flushing || stopping ||
+       ReadStatistics::timestamp() - queuedSince >= delay * 1e6);
+    if(due) {
+      lock.unlock();
+      writeQueue();
+      lock.lock();
+      continue;
+    }
+    if(stopping)
+      return;
+    wake.wait_for(lock, std::chrono::microseconds(SIGNAL_POLL));
+  }
+}
+
+void BadSectorsLog::catchSignal(int sig)
+{
+  caughtSignal = sig;
+}
+
+void BadSectorsLog::installHandlers()
+{
+  for(int i = 0; i < 3; i++) {
+    struct sigaction sa;
+    sigaction(flushSignals[i], NULL, &previousHandlers[i]);
+    // Signals that are ignored stay so (as SIGHUP under nohup)
+    if(previousHandlers[i].sa_handler == SIG_IGN)
+      continue;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &BadSectorsLog::catchSignal;
+    // The logging thread polls for the signal: reads interrupted by
+    // it must go on, not fail and show up as bad sectors.
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(flushSignals[i], &sa, NULL);
+  }
+  handlersInstalled = true;
+}
+
+void BadSectorsLog::restoreHandlers()
+{
+  if(! handlersInstalled)
+    return;
+  for(int i = 0; i < 3; i++)
+    sigaction(flushSignals[i], &previousHandlers[i], NULL);
+  handlersInstalled = false;
+  // A signal caught just now gets its due
+  int sig = caughtSignal;
+  caughtSignal = 0;
+  if(sig)
+    raise(sig);
+}
+
+void BadSectorsLog::handleSignal()
+{
+  std::lock_guard<std::mutex> lock(allLogsMutex);
+  if(! caughtSignal)
+    return;                     // Another thread was faster
+  for(int i = 0; i < allLogs.size(); i++)
+    allLogs[i]->writeQueue();
+  restoreHandlers();
+}
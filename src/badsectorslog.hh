@@ -0,0 +1,124 @@
+/**
+    \file badsectorslog.hh
+    The BadSectorsLog class, appending bad sectors in the background
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __BADSECTORSLOG_H
+#define __BADSECTORSLOG_H
+
+#include "dvdcopy.hh"
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/// Appends the bad sectors found by the first pass to the bad sectors
+/// file from a background thread, so that the reading thread never
+/// waits for the file: add() only queues the range, merging it with
+/// the previous one if they are contiguous.
+///
+/// The queue is written out and flushed to the kernel:
+///  - at most @a delay seconds after a range was queued;
+///  - when flush() is called, and when the log is destroyed;
+///  - on SIGINT, SIGTERM and SIGHUP, after which the signal is raised
+///    again with its previous handler.
+///
+/// Hence, if the program is killed otherwise (SIGKILL, a crash), the
+/// ranges found during the last @a delay seconds may be missing from
+/// the bad sectors file, although the output files already have holes
+/// there, and they won't be read again by the second pass. Ranges
+/// that are in the file are complete: a line is never written in
+/// part, except if the system itself crashes.
+class BadSectorsLog {
+  /// The bad sectors file
+  std::string fileName;
+
+  /// The file, opened for appending by the first write
+  FILE * file;
+
+  /// The ranges waiting to be written
+  std::vector<BadSectors> queue;
+
+  /// When the oldest range of the queue was added, in microseconds
+  long queuedSince;
+
+  /// The number of calls to add() so far, and the number of those
+  /// whose range was written
+  long added, written;
+
+  /// Whether flush() is waiting
+  bool flushing;
+
+  /// Whether the thread must stop
+  bool stopping;
+
+  /// The maximum delay before writing a range, in seconds
+  double delay;
+
+  /// Protects all of the above but the file
+  std::mutex mutex;
+
+  /// Protects the file, written by the thread, or by another one when
+  /// a signal is caught
+  std::mutex fileMutex;
+
+  /// Wakes up the thread
+  std::condition_variable wake;
+
+  /// Signals that ranges were written
+  std::condition_variable done;
+
+  std::thread thread;
+
+  /// The body of the thread
+  void loop();
+
+  /// Writes the whole queue out
+  void writeQueue();
+
+  /// Installs the signal handlers, when the first log is created
+  static void installHandlers();
+
+  /// Restores the previous signal handlers, when the last log is
+  /// destroyed or when a signal was caught, and raises that signal
+  /// again.
+  static void restoreHandlers();
+
+  /// The signal handler, which only records the signal
+  static void catchSignal(int sig);
+
+  /// Writes out the queues of all the logs, and raises the signal
+  /// caught again with the previous handlers.
+  static void handleSignal();
+
+public:
+
+  /// Appends to the given file, writing ranges at most @a delay
+  /// seconds after they were added.
+  BadSectorsLog(const std::string & file, double delay = 1);
+
+  /// Queues the given range. This never waits for the file.
+  void add(const BadSectors & range);
+
+  /// Waits until all the ranges added so far are written.
+  void flush();
+
+  /// Writes everything out and closes the file.
+  ~BadSectorsLog();
+};
+
+#endif
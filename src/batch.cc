@@ -0,0 +1,349 @@
+/**
+    \file batch.cc
+    Implementation of the BatchCopy class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "batch.hh"
+#include "dvdcopy.hh"
+#include "pool.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <algorithm>
+#include <thread>
+
+/// Forwards the progress of one job to the BatchCopy
+class BatchProgress : public ProgressSink {
+  BatchCopy * batch;
+  BatchJob * job;
+
+  void update(const ProgressState & state) {
+    std::lock_guard<std::mutex> lock(batch->mutex);
+    job->runDone = state.runDone;
+    job->runSectors = state.runSectors;
+    batch->displayProgress();
+  };
+
+public:
+  BatchProgress(BatchCopy * b, BatchJob * j) : batch(b), job(j) {;};
+
+  virtual void fileStarted(const ProgressState & state) {
+    update(state);
+  };
+
+  virtual void progress(const ProgressState & state) {
+    update(state);
+  };
+};
+
+/// Whether the file name ends with .iso (whatever the case)
+static bool isImage(const std::string & name)
+{
+  return name.size() > 4 &&
+    ! strcasecmp(name.c_str() + name.size() - 4, ".iso");
+}
+
+/// Whether the given path is a directory
+static bool isDirectory(const std::string & path)
+{
+  struct stat st;
+  return ! stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+}
+
+/// Returns the name of the target directory for the given source
+static std::string targetName(std::string source)
+{
+  while(source.size() > 1 && source[source.size() - 1] == '/')
+    source.erase(source.size() - 1);
+  size_t idx = source.rfind('/');
+  if(idx != std::string::npos)
+    source = source.substr(idx + 1);
+  if(isImage(source))
+    source.erase(source.size() - 4);
+  return source;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+BatchCopy::BatchCopy() : nextJob(0), startTime(0), lastDisplay(0),
+                         ioConcurrency(-1), sectorsRead(-1), vobuSkip(true),
+                         checkPacks(false), durability(SyncThread::None),
+                         syncInterval(30),
+                         catalog(NULL), onArchived(DiscCatalog::Skip)
+{
+  concurrency = std::thread::hardware_concurrency();
+  if(concurrency < 1)
+    concurrency = 1;
+}
+
+void BatchCopy::addSources(const char * sources, const char * target)
+{
+  std::vector<std::string> list;
+  std::string src = sources;
+  if(isDirectory(src)) {
+    if(isDirectory(src + "/VIDEO_TS"))
+      list.push_back(src);
+    else {
+      DIR * dir = opendir(sources);
+      if(! dir) {
+        std::string err = "Could not list directory '";
+        err += sources;
+        err += "': ";
+        err += strerror(errno);
+        throw std::runtime_error(err);
+      }
+      struct dirent * ent;
+      while((ent = readdir(dir))) {
+        std::string name = ent->d_name;
+        if(name[0] == '.')
+          continue;
+        std::string path = src + "/" + name;
+        if(isImage(name) || isDirectory(path + "/VIDEO_TS"))
+          list.push_back(path);
+      }
+      closedir(dir);
+      std::sort(list.begin(), list.end());
+    }
+  }
+  else if(isImage(src))
+    list.push_back(src);
+  else {
+    FILE * f = fopen(sources, "r");
+    if(! f) {
+      std::string err = "Could not open source list '";
+      err += sources;
+      err += "': ";
+      err += strerror(errno);
+      throw std::runtime_error(err);
+    }
+    char buffer[4096];
+    while(fgets(buffer, sizeof(buffer), f)) {
+      std::string line = buffer;
+      while(! line.empty() && isspace(line[line.size() - 1]))
+        line.erase(line.size() - 1);
+      if(line.empty() || line[0] == '#')
+        continue;
+      list.push_back(line);
+    }
+    fclose(f);
+  }
+
+  std::string base = target;
+  if(! isDirectory(base)) {
+    fprintf(stderr, "Creating directory %s\n", target);
+    mkdir(target, 0755);
+  }
+  for(int i = 0; i < list.size(); i++) {
+    std::string name = targetName(list[i]);
+    std::string dest = base + "/" + name;
+    // Make sure two sources with the same name don't end up in the
+    // same target
+    for(int j = 2; ; j++) {
+      bool used = false;
+      for(int k = 0; k < jobs.size(); k++)
+        if(jobs[k].target == dest)
+          used = true;
+      if(! used)
+        break;
+      char suffix[20];
+      snprintf(suffix, sizeof(suffix), "-%d", j);
+      dest = base + "/" + name + suffix;
+    }
+    jobs.push_back(BatchJob(list[i], dest));
+  }
+}
+
+void BatchCopy::displayProgress()
+{
+  long now = ReadStatistics::timestamp();
+  if(now - lastDisplay < 1000000)
+    return;
+  lastDisplay = now;
+
+  int finished = 0, running = 0;
+  long done = 0, total = 0;
+  for(int i = 0; i < jobs.size(); i++) {
+    const BatchJob & job = jobs[i];
+    if(job.done)
+      finished++;
+    else if(job.runSectors > 0)
+      running++;
+    done += job.runDone;
+    total += job.runSectors;
+  }
+  double elapsed = (now - startTime) * 1e-6;
+  printf("\rBatch: %d/%d done, %d running, %.1f/%.1f GB, %.1f MB/s     ",
+         finished, (int)jobs.size(), running,
+         done * 2048e-9, total * 2048e-9,
+         elapsed > 0 ? done * 2048e-6 / elapsed : 0);
+  fflush(stdout);
+}
+
+void BatchCopy::runJob(BatchJob & job, BufferPool * buffers, IOSlots * slots)
+{
+  long start = ReadStatistics::timestamp();
+  DVDCopy dvd(false);
+  dvd.sectorsRead = sectorsRead;
+  dvd.vobuSkip = vobuSkip;
+  dvd.checkPacks = checkPacks;
+  dvd.durability = durability;
+  dvd.syncInterval = syncInterval;
+  dvd.setSharedResources(buffers, slots);
+  if(catalog)
+    dvd.setCatalog(catalog, onArchived);
+  dvd.addProgressSink(new BatchProgress(this, &job));
+
+  std::string error;
+  try {
+    dvd.copy(job.source.c_str(), job.target.c_str());
+  }
+  catch(const std::exception & e) {
+    error = e.what();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  statistics.merge(dvd.readStatistics());
+  job.done = true;
+  job.success = error.empty();
+  job.error = error;
+  job.wallTime = ReadStatistics::timestamp() - start;
+  job.badSectors = dvd.badSectorCount();
+  job.sectors = job.runDone;
+  if(job.success && onArchived == DiscCatalog::Skip &&
+     ! dvd.archivedCopy().empty())
+    printf("\nSkipped %s: already archived in %s\n", job.source.c_str(),
+           dvd.archivedCopy().c_str());
+  else if(job.success)
+    printf("\nFinished %s: %ld sectors, %ld bad\n", job.source.c_str(),
+           job.sectors, job.badSectors);
+  else
+    printf("\nFailed %s: %s\n", job.source.c_str(), error.c_str());
+}
+
+void BatchCopy::worker(BufferPool * buffers, IOSlots * slots)
+{
+  while(true) {
+    BatchJob * job;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(nextJob >= jobs.size())
+        return;
+      job = &jobs[nextJob++];
+      printf("\nStarting %s -> %s\n", job->source.c_str(),
+             job->target.c_str());
+    }
+    runJob(*job, buffers, slots);
+  }
+}
+
+int BatchCopy::run()
+{
+  int nb = std::min<int>(concurrency, jobs.size());
+  if(nb < 1)
+    nb = 1;
+  int io = ioConcurrency > 0 ? ioConcurrency : nb;
+  printf("Copying %d sources, %d at a time, with at most %d concurrent reads\n",
+         (int) jobs.size(), nb, io);
+
+  // Each copy holds at most one read buffer at a time
+  BufferPool buffers(nb, std::max(sectorsRead, 128));
+  IOSlots slots(io);
+
+  startTime = ReadStatistics::timestamp();
+  statistics.setPhase("batch");
+
+  std::vector<std::thread> threads;
+  for(int i = 0; i < nb; i++)
+    threads.push_back(std::thread(&BatchCopy::worker, this,
+                                  &buffers, &slots));
+  for(int i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  if(io < nb)
+    printf("\nTime spent waiting for a read slot: %.1fs\n",
+           slots.totalWaitTime() * 1e-6);
+
+  displayReport();
+  if(! reportFile.empty()) {
+    printf("Writing batch report to '%s'\n", reportFile.c_str());
+    writeJSONReport(reportFile.c_str());
+  }
+
+  int failed = 0;
+  for(int i = 0; i < jobs.size(); i++)
+    if(! jobs[i].success)
+      failed++;
+  return failed;
+}
+
+void BatchCopy::displayReport()
+{
+  printf("\nBatch report:\n");
+  long sectors = 0, bad = 0;
+  for(int i = 0; i < jobs.size(); i++) {
+    const BatchJob & job = jobs[i];
+    if(job.success)
+      printf(" %-40s %8ld sectors, %6ld bad, %7.1fs\n",
+             job.source.c_str(), job.sectors, job.badSectors,
+             job.wallTime * 1e-6);
+    else
+      printf(" %-40s FAILED: %s\n", job.source.c_str(), job.error.c_str());
+    sectors += job.sectors;
+    bad += job.badSectors;
+  }
+  double elapsed = (ReadStatistics::timestamp() - startTime) * 1e-6;
+  printf(" total: %ld sectors (%.1f GB), %ld bad, in %.1fs (%.1f MB/s)\n",
+         sectors, sectors * 2048e-9, bad, elapsed,
+         elapsed > 0 ? sectors * 2048e-6 / elapsed : 0);
+
+  statistics.displayHistograms();
+  statistics.displayReport();
+}
+
+void BatchCopy::writeJSONReport(const char * fileName)
+{
+  FILE * out = fopen(fileName, "w");
+  if(! out) {
+    std::string err = "Could not open report file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "{\n\"jobs\": [");
+  for(int i = 0; i < jobs.size(); i++) {
+    const BatchJob & job = jobs[i];
+    fprintf(out, "%s\n  {\"source\": %s, \"target\": %s, "
+            "\"success\": %s, \"error\": %s, \"sectors\": %ld, "
+            "\"bad_sectors\": %ld, \"wall_us\": %ld}",
+            i ? "," : "", EventStream::quote(job.source).c_str(),
+            EventStream::quote(job.target).c_str(),
+            job.success ? "true" : "false",
+            EventStream::quote(job.error).c_str(),
+            job.sectors, job.badSectors, job.wallTime);
+  }
+  fprintf(out, "\n],\n\"statistics\": ");
+  statistics.writeJSON(out);
+  fprintf(out, "}\n");
+  fclose(out);
+}
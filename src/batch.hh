@@ -0,0 +1,146 @@
+/**
+    \file batch.hh
+    The BatchCopy class, to copy many images at once
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "readstats.hh"
+#include "catalog.hh"
+#include "syncthread.hh"
+
+#include <mutex>
+
+class BufferPool;
+class IOSlots;
+
+/// One copy within a batch.
+class BatchJob {
+public:
+  /// The source (image or directory)
+  std::string source;
+
+  /// The target directory
+  std::string target;
+
+  /// Whether the job has run, and whether it succeeded
+  bool done, success;
+
+  /// The error message, if it failed
+  std::string error;
+
+  /// The number of sectors processed, and how many of them are bad
+  long sectors, badSectors;
+
+  /// The wall clock time of the job, in microseconds
+  long wallTime;
+
+  /// The sectors processed so far and the total, while it runs
+  long runDone, runSectors;
+
+  BatchJob(const std::string & s, const std::string & t) :
+    source(s), target(t), done(false), success(false),
+    sectors(0), badSectors(0), wallTime(0), runDone(0), runSectors(0) {;};
+};
+
+/// Copies a whole library of images (or DVD directories), running
+/// several DVDCopy at the same time. All the copies share a pool of
+/// read buffers, a limit on the number of concurrent reads, and
+/// their statistics are gathered in a single report.
+class BatchCopy {
+  /// The jobs, in the order in which they are started
+  std::vector<BatchJob> jobs;
+
+  /// The combined statistics
+  ReadStatistics statistics;
+
+  /// Protects the jobs and the combined statistics
+  std::mutex mutex;
+
+  /// The index of the next job to be started
+  int nextJob;
+
+  /// The time at which the batch started, in microseconds
+  long startTime;
+
+  /// The last time the progress line was updated, in microseconds
+  long lastDisplay;
+
+  /// Runs jobs until there are none left.
+  void worker(BufferPool * buffers, IOSlots * slots);
+
+  /// Runs the given job
+  void runJob(BatchJob & job, BufferPool * buffers, IOSlots * slots);
+
+  /// Displays the progress line. Must be called with the mutex held.
+  void displayProgress();
+
+  friend class BatchProgress;
+
+public:
+
+  BatchCopy();
+
+  /// Adds the jobs to copy @a sources into subdirectories of @a
+  /// target. @a sources is either a directory containing images
+  /// (.iso files) and DVD directories (with a VIDEO_TS
+  /// subdirectory), or a text file listing the sources, one per line.
+  void addSources(const char * sources, const char * target);
+
+  /// Runs all the jobs, and returns the number of those that failed.
+  int run();
+
+  /// Displays a summary of the jobs and the combined statistics.
+  void displayReport();
+
+  /// Writes the combined report in JSON format.
+  void writeJSONReport(const char * file);
+
+  /// The number of copies running at the same time (by default, the
+  /// number of processors).
+  int concurrency;
+
+  /// The maximum number of reads running at the same time (by
+  /// default, the same as concurrency).
+  int ioConcurrency;
+
+  /// Number of sectors read in one go
+  int sectorsRead;
+
+  /// Whether read errors skip to the next VOBU
+  bool vobuSkip;
+
+  /// Whether the copies check that the VOB sectors are MPEG packs
+  bool checkPacks;
+
+  /// The durability policy of the copies, and the interval of the
+  /// periodic one (see SyncThread)
+  SyncThread::Policy durability;
+  double syncInterval;
+
+  /// If not empty, the file in which the combined report is written
+  /// in JSON format
+  std::string reportFile;
+
+  /// If not NULL, the catalog of the archived discs, and what to do
+  /// with those found in there
+  DiscCatalog * catalog;
+  DiscCatalog::Policy onArchived;
+};
+
+#endif
@@ -0,0 +1,133 @@
+/**
+    \file catalog.cc
+    Implementation of the DiscCatalog class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "catalog.hh"
+#include "syncthread.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+DiscCatalog::Policy DiscCatalog::parsePolicy(const char * name)
+{
+  std::string n = name;
+  if(n == "skip")
+    return Skip;
+  if(n == "merge")
+    return Merge;
+  if(n == "copy")
+    return Copy;
+  std::string err = "Unknown policy for archived discs: '";
+  err += name;
+  err += "' (should be skip, merge or copy)";
+  throw std::runtime_error(err);
+}
+
+DiscCatalog::DiscCatalog(const char * file) : fileName(file)
+{
+  FILE * f = fopen(file, "r");
+  if(! f)
+    return;                     // Nothing archived yet
+  char buffer[4096];
+  while(fgets(buffer, sizeof(buffer), f)) {
+    if(buffer[0] == '#')
+      continue;
+    char * fields[4];
+    int nb = 0;
+    char * cur = buffer;
+    fields[nb++] = cur;
+    while(nb < 4 && (cur = strchr(cur, '\t'))) {
+      *cur++ = 0;
+      fields[nb++] = cur;
+    }
+    if(nb < 4)
+      continue;
+    size_t len = strlen(fields[3]);
+    while(len > 0 && (fields[3][len-1] == '\n' || fields[3][len-1] == '\r'))
+      fields[3][--len] = 0;
+
+    CatalogEntry e;
+    e.fingerprint = fields[0];
+    e.badSectors = atol(fields[1]);
+    e.date = atol(fields[2]);
+    e.target = fields[3];
+    entries.push_back(e);
+  }
+  fclose(f);
+}
+
+bool DiscCatalog::find(const std::string & fingerprint, CatalogEntry * entry)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for(int i = entries.size() - 1; i >= 0; i--) {
+    if(entries[i].fingerprint == fingerprint) {
+      *entry = entries[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+void DiscCatalog::save()
+{
+  std::string tmp = fileName + ".tmp";
+  FILE * f = fopen(tmp.c_str(), "w");
+  if(! f) {
+    std::string err = "Could not write catalog '";
+    err += tmp;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(f, "# dvdcopy catalog: fingerprint, bad sectors, date, target\n");
+  for(int i = 0; i < entries.size(); i++)
+    fprintf(f, "%s\t%ld\t%ld\t%s\n", entries[i].fingerprint.c_str(),
+            entries[i].badSectors, entries[i].date,
+            entries[i].target.c_str());
+  // Both the contents and the rename must reach the disc, else the
+  // catalog may come back empty after a crash.
+  fflush(f);
+  fdatasync(fileno(f));
+  fclose(f);
+  if(rename(tmp.c_str(), fileName.c_str())) {
+    std::string err = "Could not replace catalog '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  SyncThread::syncDirectory(fileName);
+}
+
+void DiscCatalog::record(const CatalogEntry & entry)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  bool found = false;
+  for(int i = 0; i < entries.size(); i++) {
+    if(entries[i].fingerprint == entry.fingerprint &&
+       entries[i].target == entry.target) {
+      entries[i] = entry;
+      found = true;
+    }
+  }
+  if(! found)
+    entries.push_back(entry);
+  save();
+}
@@ -0,0 +1,93 @@
+/**
+    \file catalog.hh
+    The DiscCatalog class, a list of the discs already archived
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __CATALOG_H
+#define __CATALOG_H
+
+#include <mutex>
+
+/// A disc in the catalog
+class CatalogEntry {
+public:
+  /// The fingerprint of the disc (see DVDCopy::fingerprint())
+  std::string fingerprint;
+
+  /// The directory the disc was copied to
+  std::string target;
+
+  /// The number of sectors that could not be read
+  long badSectors;
+
+  /// When it was archived (or last updated), in seconds since the
+  /// epoch
+  long date;
+
+  CatalogEntry() : badSectors(0), date(0) {;};
+};
+
+/// The catalog of the discs archived so far, kept in a single text
+/// file with one disc per line:
+///
+/// fingerprint  bad-sectors  date  target
+///
+/// separated by tabs. The whole file is read at startup, lookups are
+/// done in memory.
+class DiscCatalog {
+  /// The file
+  std::string fileName;
+
+  /// The entries, in the order of the file
+  std::vector<CatalogEntry> entries;
+
+  /// Protects the entries and the file, as several copies may use
+  /// the same catalog at the same time.
+  std::mutex mutex;
+
+  /// Rewrites the whole file
+  void save();
+
+public:
+
+  /// What to do with discs that are already in the catalog
+  enum Policy {
+    /// Don't copy again
+    Skip,
+    /// Copy only what is missing in the archived copy, in place
+    Merge,
+    /// Copy anyway, as requested
+    Copy
+  };
+
+  /// Parses a policy name (skip, merge or copy)
+  static Policy parsePolicy(const char * name);
+
+  /// Loads the catalog from the given file, which need not exist
+  /// yet.
+  DiscCatalog(const char * file);
+
+  /// Returns the most recent entry with the given fingerprint, or
+  /// false if there is none.
+  bool find(const std::string & fingerprint, CatalogEntry * entry);
+
+  /// Records the given entry, replacing the one with the same
+  /// fingerprint and target if there is one.
+  void record(const CatalogEntry & entry);
+};
+
+#endif
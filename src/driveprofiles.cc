@@ -0,0 +1,111 @@
+/**
+    \file driveprofiles.cc
+    Implementation of the DriveProfiles class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "driveprofiles.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/// Profiles older than that are calibrated again, in seconds
+#define MAX_AGE (30*24*3600)
+
+/// Profiles used that many times are calibrated again
+#define MAX_USES 50
+
+DriveProfiles::DriveProfiles(const char * file) : fileName(file)
+{
+  FILE * f = fopen(file, "r");
+  if(! f)
+    return;                     // No drive calibrated yet
+  char buffer[4096];
+  while(fgets(buffer, sizeof(buffer), f)) {
+    if(buffer[0] == '#')
+      continue;
+    DriveProfile p;
+    char identity[4096];
+    if(sscanf(buffer, "%d\t%lf\t%ld\t%d\t%4095[^\n]", &p.readSize,
+              &p.throughput, &p.date, &p.uses, identity) != 5)
+      continue;
+    p.identity = identity;
+    profiles.push_back(p);
+  }
+  fclose(f);
+}
+
+void DriveProfiles::save()
+{
+  std::string tmp = fileName + ".tmp";
+  FILE * f = fopen(tmp.c_str(), "w");
+  if(! f) {
+    std::string err = "Could not write drive profiles '";
+    err += tmp;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(f, "# dvdcopy drive profiles: read size, throughput (MB/s), "
+          "date, uses, drive\n");
+  for(int i = 0; i < profiles.size(); i++)
+    fprintf(f, "%d\t%.2f\t%ld\t%d\t%s\n", profiles[i].readSize,
+            profiles[i].throughput, profiles[i].date, profiles[i].uses,
+            profiles[i].identity.c_str());
+  fclose(f);
+  if(rename(tmp.c_str(), fileName.c_str())) {
+    std::string err = "Could not replace drive profiles '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+}
+
+bool DriveProfiles::lookup(const std::string & identity,
+                           DriveProfile * profile)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  for(int i = 0; i < profiles.size(); i++) {
+    DriveProfile & p = profiles[i];
+    if(p.identity != identity)
+      continue;
+    if(time(NULL) - p.date > MAX_AGE || p.uses >= MAX_USES)
+      return false;
+    p.uses += 1;
+    save();
+    *profile = p;
+    return true;
+  }
+  return false;
+}
+
+void DriveProfiles::record(const DriveProfile & profile)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  bool found = false;
+  for(int i = 0; i < profiles.size(); i++) {
+    if(profiles[i].identity == profile.identity) {
+      profiles[i] = profile;
+      found = true;
+    }
+  }
+  if(! found)
+    profiles.push_back(profile);
+  save();
+}
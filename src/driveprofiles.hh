@@ -0,0 +1,83 @@
+/**
+    \file driveprofiles.hh
+    The DriveProfiles class, the best read size of each drive model
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __DRIVEPROFILES_H
+#define __DRIVEPROFILES_H
+
+#include <mutex>
+
+/// The read size calibrated for a drive model
+class DriveProfile {
+public:
+  /// The drive, as given by DVDDrive::identity()
+  std::string identity;
+
+  /// The best number of sectors read in one go
+  int readSize;
+
+  /// The throughput with that read size, in MB/s
+  double throughput;
+
+  /// When the calibration was done, in seconds since the epoch
+  long date;
+
+  /// The number of copies that used it since
+  int uses;
+
+  DriveProfile() : readSize(0), throughput(0), date(0), uses(0) {;};
+};
+
+/// The read sizes calibrated for the drives (see
+/// DVDCopy::calibrateReadSize()), kept in a text file with one drive
+/// per line:
+///
+/// read-size  throughput  date  uses  identity
+///
+/// separated by tabs. A profile is calibrated again when it is more
+/// than 30 days old or was used 50 times, as drives wear out and the
+/// discs change.
+class DriveProfiles {
+  /// The file
+  std::string fileName;
+
+  /// The profiles, in the order of the file
+  std::vector<DriveProfile> profiles;
+
+  /// Protects the profiles and the file, as several copies may use
+  /// them at the same time.
+  std::mutex mutex;
+
+  /// Rewrites the whole file
+  void save();
+
+public:
+
+  /// Loads the profiles from the given file, which need not exist
+  /// yet.
+  DriveProfiles(const char * file);
+
+  /// Returns the profile of the drive and counts one more use, or
+  /// returns false if there is none or if it is due for revalidation.
+  bool lookup(const std::string & identity, DriveProfile * profile);
+
+  /// Records the profile, replacing the one of the same drive.
+  void record(const DriveProfile & profile);
+};
+
+#endif
@@ -24,6 +24,12 @@
 #include "dvdoutfile.hh"
 
 #include "dvddrive.hh"
+#include "driveprofiles.hh"
+#include "trace.hh"
+#include "retryhistory.hh"
+#include "stages.hh"
+#include "badsectorslog.hh"
+#include "outputfiles.hh"
 
 #include <stdio.h>
 
@@ -32,9 +38,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <sys/time.h>
 
+#include <algorithm>
+
 // use of regular expressions !
 #include <regex.h>
 
@@ -66,9 +75,22 @@ bool BadSectors::tryMerge(const BadSectors & follower)
 //////////////////////////////////////////////////////////////////////
 
 
-DVDCopy::DVDCopy() : badSectors(NULL), sectorsRead(-1), skipBUP(false)
+DVDCopy::DVDCopy(bool inter) : retrying(false), journal(true),
+                               badSectors(NULL),
+                               catalog(NULL), onArchived(DiscCatalog::Skip),
+                               profiles(NULL), recalibrate(false),
+                               readSize(-1), interactive(inter),
+                               buffers(NULL), ioSlots(NULL),
+                               writers(NULL), writerChannel(NULL),
+                               outputFiles(NULL), skipBUP(false),
+                               sectorsRead(-1), vobuSkip(true),
+                               durability(SyncThread::None),
+                               syncInterval(30), checkPacks(false),
+                               maxRetryFailures(3)
 {
   reader = NULL;
+  if(interactive)
+    progress.addSink(new TerminalProgress);
 }
 
 #define STANDARD_READ 128
@@ -86,8 +108,10 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
 
   if(skipBUP && dat->isBackup()) {
     // But, that may be a bad idea ?
-    std::cout << std::flush << "\nSkipping backup file: " 
-              << dat->fileName() << std::endl;
+    if(interactive)
+      std::cout << std::flush << "\nSkipping backup file: " 
+                << dat->fileName() << std::endl;
+    progress.note("skip-file", dat->fileName(true));
     return 0;
   }
     
@@ -99,9 +123,11 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
     std::string source = targetDirectory + dat->dup->fileName();
     std::string target = targetDirectory + dat->fileName();
     if(stat(target.c_str(), &st)) {
-      std::cout << "Hardlinking " 
-                << target << " to " << source << std::endl;
+      if(interactive)
+        std::cout << "Hardlinking " 
+                  << target << " to " << source << std::endl;
       link(source.c_str(), target.c_str());
+      progress.note("hardlink", dat->fileName(true));
     }
     else {
       struct stat stold;
@@ -119,9 +145,10 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
           "You must remove it to proceed";
         throw std::runtime_error(error);
       }
-      std::cout << "Not hardlinking " 
-                << target << " to " << source 
-                << ", already done" << std::endl;
+      if(interactive)
+        std::cout << "Not hardlinking " 
+                  << target << " to " << source 
+                  << ", already done" << std::endl;
       return 0;
     }
     return 0;
@@ -138,42 +165,69 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
     extractIFOSizes(dat, &ifoSectors);
   
 
-  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+  std::unique_ptr<DVDFile> file(openFile(dat));
   if(! file) {
     std::string fileName = dat->fileName(true);
-    printf("\nSkipping file %s (not found)\n", fileName.c_str());
+    if(interactive)
+      printf("\nSkipping file %s (not found)\n", fileName.c_str());
+    progress.note("missing-file", fileName);
     return 0;
   }
   DVDOutFile outfile(targetDirectory.c_str(), dat->title, dat->domain);
+  setupOutputFile(outfile);
 
   int skipped = 0;
-  auto success = [&outfile](int offset, int nb, 
-                            unsigned char * buffer,
-                            const DVDFileData * dat) {
-    outfile.writeSectors(reinterpret_cast<char*>(buffer), nb);
-  };
-
-  auto failure = [&outfile, &skipped, this](int blk, int nb, 
+  OutputStage output(outfile);
+  auto bad = functionStage([](int offset, int nb, unsigned char * buffer,
+                              const DVDFileData * dat) {
+                           },
+                           [&skipped, this](int blk, int nb,
                                             const DVDFileData * dat) {
-    outfile.skipSectors(nb);
-    registerBadSectors(dat, blk, nb);
-    skipped += nb;
-  };
+                             registerBadSectors(dat, blk, nb);
+                             skipped += nb;
+                           });
+  // The bad sectors are registered before the output file moves past
+  // them (see SyncThread).
+  auto copyStages = pipeline(bad, output);
+  // The sectors that aren't packs don't make it to the copy
+  PackCheckStage<decltype(copyStages)> packCheck(copyStages);
+  auto checkStages = pipeline(packCheck);
+  ReadSink & stages = checkPacks && (dat->domain == DVD_READ_TITLE_VOBS ||
+                                     dat->domain == DVD_READ_MENU_VOBS) ?
+    static_cast<ReadSink &>(checkStages) : copyStages;
 
   int size = file->fileSize();
   /// @todo make that configurable
   if(ifoSectors > 0 && size > ifoSectors) {
     std::string fileName = dat->fileName(true);
-    printf("\nIFO headers say read only %d sectors instead of %d for file %s\n",
-           ifoSectors, size, fileName.c_str());
+    if(interactive)
+      printf("\nIFO headers say read only %d sectors instead of %d "
+             "for file %s\n", ifoSectors, size, fileName.c_str());
+    progress.note("ifo-size", fileName);
+    if(blockNumber < 0)
+      progress.alreadyDone(size - ifoSectors);
     size = ifoSectors;
   }
   int current_size = outfile.fileSize();
-  if(firstBlock > 0)
+  int durable = syncer && firstBlock < 0 ?
+    syncer->durableSectors(dat->title, dat->domain) : -1;
+  if(durable >= 0 && durable < current_size) {
+    if(interactive)
+      printf("\nOnly the first %d sectors of %s are known to be on disc, "
+             "reading again from there\n", durable,
+             dat->fileName(true).c_str());
+    progress.note("not-durable", dat->fileName(true));
+    current_size = durable;
+  }
+  if(firstBlock >= 0)
     current_size = firstBlock; 
+  else if(blockNumber < 0)
+    progress.alreadyDone(current_size);
 
   if(current_size == size) {
-    printf("File already fully read: not reading again\n");
+    if(interactive)
+      printf("File already fully read: not reading again\n");
+    progress.note("already-read", dat->fileName(true));
     return 0;
   }
   if(blockNumber < 0)
@@ -181,11 +235,10 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
 
   outfile.seek(current_size);
 
-  file->walkFile(current_size, blockNumber, readNumber, 
-                 success, failure);
+  file->walkFile(current_size, blockNumber, readNumber, stages);
 
   outfile.closeFile(); 
-  if(skipped) {
+  if(skipped && interactive) {
     printf("\nThere were %d sectors skipped in this title set\n",
            skipped);
   }
@@ -194,91 +247,507 @@ int DVDCopy::copyFile(const DVDFileData * dat, int firstBlock,
 
 void DVDCopy::setup(const char *device, const char * target)
 {
-  DVDReader r(device);
+  TRACE_SPAN("setup");
   sourceDevice = device;
-  files = r.listFiles();
+  source.reset(new DVDReader(device));
+  files = source->listFiles();
+  reader = source->handle();
+  ifoCache.reset(new IFOCache(reader, &statistics));
 
-  reader = DVDOpen(device);
-  if(! reader) {
-    std::string err("Error opening device ");
-    err += device;
-    throw std::runtime_error(err);
-  }
+  if(target)
+    setupTarget(target);
+}
 
-  if(target) {
-    char buf[1024];
-    targetDirectory = target;
-    struct stat dummy;
-    if(stat(target,&dummy)) {
+void DVDCopy::setupTarget(const char * target)
+{
+  char buf[1024];
+  targetDirectory = target;
+  struct stat dummy;
+  if(stat(target,&dummy)) {
+    if(interactive)
       fprintf(stderr,"Creating directory %s\n", target);
-      mkdir(target, 0755);
-    }
+    mkdir(target, 0755);
+  }
 
-    /* Then, create the VIDEO_TS subdir if necessary */
-    snprintf(buf, sizeof(buf), "%s/VIDEO_TS", target);
-    if(stat(buf, &dummy))  {
+  /* Then, create the VIDEO_TS subdir if necessary */
+  snprintf(buf, sizeof(buf), "%s/VIDEO_TS", target);
+  if(stat(buf, &dummy))  {
+    if(interactive)
       fprintf(stderr,"Creating directory %s\n", buf);
-      mkdir(buf, 0755);
-    }
+    mkdir(buf, 0755);
   }
 
+  // All the output files of the run write through the same
+  // descriptors, unless they are shared with other copies
+  if(! outputFiles || outputFiles == ownOutputFiles.get()) {
+    ownOutputFiles.reset(new OutputFiles(targetDirectory));
+    outputFiles = ownOutputFiles.get();
+  }
+
+  if(durability != SyncThread::None && ! syncer) {
+    // The SyncThread needs it, it must not change from now on
+    if(badSectorsFileName.empty())
+      badSectorsFileName = targetDirectory + ".bad";
+    syncer.reset(new SyncThread(targetDirectory, durability, syncInterval));
+    syncer->setBadSectorsSync([this]() { syncBadSectors(); });
+  }
 }
 
 void DVDCopy::copy(const char *device, const char * target)
 {
-  setup(device, target);
+  setup(device, NULL);
+
+  std::string fp;
+  std::string dest = target;
+  bool merge = false;
+  if(catalog) {
+    fp = fingerprint();
+    CatalogEntry entry;
+    if(catalog->find(fp, &entry)) {
+      archivedTarget = entry.target;
+      if(interactive)
+        printf("This disc was already archived in %s (%ld bad sectors)\n",
+               entry.target.c_str(), entry.badSectors);
+      progress.note("archived", entry.target);
+      if(onArchived == DiscCatalog::Skip) {
+        if(interactive)
+          printf("Not copying it again\n");
+        return;
+      }
+      if(onArchived == DiscCatalog::Merge) {
+        if(interactive)
+          printf("Reading only what is missing from the archived copy\n");
+        dest = entry.target;
+        merge = true;
+      }
+    }
+  }
+  setupTarget(dest.c_str());
+  tuneReadSize();
+  setPhase("copy", dest);
+
+  long total = 0;
+  for(std::vector<DVDFileData *>::iterator i = files.begin(); 
+      i != files.end(); i++) {
+    const DVDFileData * dat = *i;
+    if(dat->dup || (skipBUP && dat->isBackup()))
+      continue;
+    total += (dat->size + 2047)/2048;
+  }
+  progress.startRun(total);
 
   /// Methodically copies all listed files
   for(std::vector<DVDFileData *>::iterator i = files.begin(); 
       i != files.end(); i++)
-    copyFile(*i);
+    copyFile(*i, -1, -1, readSize);
+  closeBadSectorsFile();
+
+  if(merge)
+    retryBadSectors();
+
+  setPhase("done");
+  writeStatistics();
+  if(catalog)
+    recordInCatalog(fp);
 }
 
 void DVDCopy::secondPass(const char *device, const char * target)
 {
   setup(device, target);
+  retryBadSectors();
+  setPhase("done");
+  writeStatistics();
+}
+
+void DVDCopy::retryBadSectors()
+{
+  closeBadSectorsFile();
+  badSectorsList.clear();
   readBadSectors();
   closeBadSectorsFile();
-  badSectors = NULL;
   int totalMissing = 0;
 
   std::vector<BadSectors> oldBadSectors;
   std::swap(oldBadSectors, badSectorsList);
+  setPhase("second-pass", targetDirectory);
+
+  // What is not selected stays in the bad sectors file as it is
+  std::vector<BadSectors> outside;
+  selectBadSectors(oldBadSectors, &outside);
+  for(int i = 0; i < outside.size(); i++) {
+    registerBadSectors(outside[i].file, outside[i].start,
+                       outside[i].number, true);
+    totalMissing += outside[i].number;
+  }
+
+  // Sectors that are the same on the disc as those of another range
+  // are read only once
+  std::vector<BadAlias> aliases;
+  aliasBadSectors(oldBadSectors, &aliases);
+
+  // The most promising ranges first, as far as the previous passes
+  // tell.
+  RetryHistory history(badSectorsFileName + ".history");
+  {
+    std::vector<std::pair<double, int> > order;
+    for(int i = 0; i < oldBadSectors.size(); i++)
+      order.push_back(std::make_pair(-history.expectedYield(oldBadSectors[i]),
+                                     i));
+    std::sort(order.begin(), order.end());
+    std::vector<BadSectors> sorted;
+    for(int i = 0; i < order.size(); i++)
+      sorted.push_back(oldBadSectors[order[i].second]);
+    std::swap(sorted, oldBadSectors);
+  }
+
+  // The point here is to read every sector that can be, not to get
+  // past the damage quickly.
+  retrying = true;
+
+  long total = 0;
+  for(int i = 0; i < oldBadSectors.size(); i++)
+    if(! history.givenUp(oldBadSectors[i], maxRetryFailures))
+      total += oldBadSectors[i].number;
+  progress.startRun(total);
 
   for(int i = 0; i < oldBadSectors.size(); i++) {
     BadSectors & bs = oldBadSectors[i];
-    printf("Trying to read %d bad sectors from file %s at %d:\n",
-           bs.number,
-           bs.file->fileName().c_str(),
-           bs.start);
-    int nb = copyFile(bs.file, bs.start, bs.number, 
-                      (sectorsRead > 0 ? sectorsRead : 1));
-    if(nb > 0)
-      printf("\n -> still got %d bad sectors (out of %d)\n",
-             nb, bs.number);
-    else
-      printf("\n -> apparently successfully read missing sectors\n");
+    int nb;
+    if(history.givenUp(bs, maxRetryFailures)) {
+      if(interactive)
+        printf("Giving up on %d bad sectors from file %s at %d: "
+               "failed %d times in a row\n", bs.number,
+               bs.file->fileName().c_str(), bs.start,
+               history.find(bs)->failures);
+      progress.note("give-up", bs.file->fileName(true));
+      registerBadSectors(bs.file, bs.start, bs.number, true);
+      nb = bs.number;
+    }
+    else {
+      if(interactive)
+        printf("Trying to read %d bad sectors from file %s at %d:\n",
+               bs.number,
+               bs.file->fileName().c_str(),
+               bs.start);
+      long before = ReadStatistics::timestamp();
+      nb = copyFile(bs.file, bs.start, bs.number, 
+                    (sectorsRead > 0 ? sectorsRead : 16));
+      // What was read must be on disc before the range leaves the
+      // bad sectors file
+      if(syncer)
+        syncer->syncFile(bs.file->title, bs.file->domain);
+      history.record(bs, bs.number - nb,
+                     ReadStatistics::timestamp() - before, sourceDevice);
+      if(interactive && nb > 0)
+        printf("\n -> still got %d bad sectors (out of %d)\n",
+               nb, bs.number);
+      else if(interactive)
+        printf("\n -> apparently successfully read missing sectors\n");
+      char buffer[100];
+      snprintf(buffer, sizeof(buffer), "%d/%d", nb, bs.number);
+      progress.note("range-done", buffer);
+    }
     totalMissing += nb;
 
-    // Now, we update the bad sectors list file
-    printf("Updating the bad sectors file '%s'\n",
-           badSectorsFileName.c_str());
+    // Now, we update the bad sectors list file, and the history
+    if(interactive)
+      printf("Updating the bad sectors file '%s'\n",
+             badSectorsFileName.c_str());
+    std::vector<BadSectors> remaining = badSectorsList;
+    remaining.insert(remaining.end(), oldBadSectors.begin() + i + 1,
+                     oldBadSectors.end());
+    for(int j = 0; j < aliases.size(); j++)
+      remaining.push_back(aliases[j].range);
+    writeBadSectors(remaining);
+    history.save(remaining);
+  }
+  retrying = false;
+
+  if(! aliases.empty()) {
+    size_t before = badSectorsList.size();
+    resolveAliases(aliases, badSectorsList);
+    for(int i = before; i < badSectorsList.size(); i++)
+      totalMissing += badSectorsList[i].number;
+    writeBadSectors(badSectorsList);
+    history.save(badSectorsList);
+  }
+  if(interactive)
+    printf("\nAltogether, there are still %d missing sectors\n", 
+           totalMissing);
+  progress.note("still-missing", std::to_string(totalMissing));
+}
+
+void DVDCopy::selectBadSectors(std::vector<BadSectors> & bad,
+                               std::vector<BadSectors> * outside)
+{
+  if(parts.empty())
+    return;
+
+  TitleMap map(ifoCache.get(), files);
+  std::map<int, std::vector<VOBRange> > ranges;
+  for(int i = 0; i < parts.size(); i++) {
+    std::vector<VOBRange> r = map.sectors(parts[i]);
+    long nb = 0;
+    for(int j = 0; j < r.size(); j++) {
+      ranges[r[j].titleSet].push_back(r[j]);
+      nb += r[j].end - r[j].start;
+    }
+    if(interactive)
+      printf("Selected %s: %ld sectors of title set %d\n",
+             parts[i].toString().c_str(), nb,
+             r.empty() ? 0 : r[0].titleSet);
+    progress.note("selected", parts[i].toString());
+  }
+  for(std::map<int, std::vector<VOBRange> >::iterator i = ranges.begin();
+      i != ranges.end(); i++)
+    std::sort(i->second.begin(), i->second.end(),
+              [](const VOBRange & a, const VOBRange & b) {
+                return a.start < b.start;
+              });
+
+  std::vector<BadSectors> inside;
+  long total = 0, selected = 0;
+  for(int i = 0; i < bad.size(); i++) {
+    const BadSectors & bs = bad[i];
+    total += bs.number;
+    if(bs.file->domain != DVD_READ_TITLE_VOBS ||
+       ranges.find(bs.file->title) == ranges.end()) {
+      outside->push_back(bs);
+      continue;
+    }
+    const std::vector<VOBRange> & r = ranges[bs.file->title];
+    int cur = bs.start, end = bs.start + bs.number;
+    for(int j = 0; j < r.size() && cur < end; j++) {
+      if(r[j].end <= cur)
+        continue;
+      if(r[j].start >= end)
+        break;
+      if(r[j].start > cur)
+        outside->push_back(BadSectors(bs.file, cur, r[j].start - cur));
+      int stop = std::min(end, r[j].end);
+      int from = std::max(cur, r[j].start);
+      inside.push_back(BadSectors(bs.file, from, stop - from));
+      selected += stop - from;
+      cur = stop;
+    }
+    if(cur < end)
+      outside->push_back(BadSectors(bs.file, cur, end - cur));
+  }
+  if(interactive)
+    printf("Retrying only the %ld bad sectors within the selection, "
+           "out of %ld\n", selected, total);
+  progress.note("selected-bad", std::to_string(selected));
+  std::swap(bad, inside);
+}
+
+long DVDCopy::discSector(const DVDFileData * dat, int offset,
+                         int * contiguous)
+{
+  // The title VOBs are read as a single file, made of all the parts
+  const DVDFileData * part = NULL;
+  int sectors = 0;
+  for(int i = 0; i < files.size(); i++) {
+    const DVDFileData * f = files[i];
+    if(f->title != dat->title || f->domain != dat->domain ||
+       f->number < dat->number)
+      continue;
+    if(f != dat && dat->domain != DVD_READ_TITLE_VOBS)
+      continue;
+    sectors = (f->size + 2047)/2048;
+    if(offset < sectors) {
+      part = f;
+      break;
+    }
+    offset -= sectors;
+  }
+  if(! part || part->startSector < 0)
+    return -1;
+  *contiguous = sectors - offset;
+  return part->startSector + offset;
+}
+
+void DVDCopy::aliasBadSectors(std::vector<BadSectors> & bad,
+                              std::vector<BadAlias> * aliases)
+{
+  // The sectors of the disc already tried through a range, by first
+  // sector
+  class Claim {
+  public:
+    long end;
+    const DVDFileData * file;
+    int start;
+  };
+  std::map<long, Claim> claimed;
+
+  std::vector<BadSectors> owned;
+  long aliased = 0;
+  for(int i = 0; i < bad.size(); i++) {
+    const BadSectors & bs = bad[i];
+    int offset = bs.start, left = bs.number;
+    while(left > 0) {
+      int contiguous;
+      long lba = discSector(bs.file, offset, &contiguous);
+      if(lba < 0) {
+        owned.push_back(BadSectors(bs.file, offset, left));
+        break;
+      }
+      int nb = std::min(left, contiguous);
+      long cur = lba;
+      while(cur < lba + nb) {
+        int at = offset + (cur - lba);
+        std::map<long, Claim>::iterator next = claimed.upper_bound(cur);
+        if(next != claimed.begin()) {
+          std::map<long, Claim>::iterator prev = next;
+          prev--;
+          if(prev->second.end > cur) {
+            long end = std::min(prev->second.end, lba + nb);
+            aliases->push_back(BadAlias(BadSectors(bs.file, at, end - cur),
+                                        prev->second.file,
+                                        prev->second.start +
+                                        (cur - prev->first)));
+            aliased += end - cur;
+            cur = end;
+            continue;
+          }
+        }
+        long end = lba + nb;
+        if(next != claimed.end() && next->first < end)
+          end = next->first;
+        BadSectors piece(bs.file, at, end - cur);
+        if(owned.empty() || ! owned.back().tryMerge(piece))
+          owned.push_back(piece);
+        Claim c;
+        c.end = end;
+        c.file = bs.file;
+        c.start = at;
+        claimed[cur] = c;
+        cur = end;
+      }
+      offset += nb;
+      left -= nb;
+    }
+  }
+  if(aliased > 0 && interactive)
+    printf("%ld bad sectors are the same on the disc as others, "
+           "they are read only once\n", aliased);
+  if(aliased > 0)
+    progress.note("aliased", std::to_string(aliased));
+  std::swap(bad, owned);
+}
+
+void DVDCopy::resolveAliases(const std::vector<BadAlias> & aliases,
+                             std::vector<BadSectors> & bad)
+{
+  for(int i = 0; i < aliases.size(); i++) {
+    const BadAlias & a = aliases[i];
+    int nb = a.range.number;
+
+    // The sectors the owner still misses
+    std::vector<std::pair<int, int> > missing;
+    for(int j = 0; j < bad.size(); j++) {
+      const BadSectors & b = bad[j];
+      if(b.file != a.owner)
+        continue;
+      int s = std::max(b.start, a.ownerStart);
+      int e = std::min(b.start + b.number, a.ownerStart + nb);
+      if(s < e)
+        missing.push_back(std::make_pair(s - a.ownerStart, e - a.ownerStart));
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.push_back(std::make_pair(nb, nb));
+
+    int cur = 0;
+    for(int j = 0; j < missing.size(); j++) {
+      if(missing[j].first > cur)
+        copySectors(a.owner, a.ownerStart + cur, a.range.file,
+                    a.range.start + cur, missing[j].first - cur);
+      if(missing[j].second > missing[j].first)
+        bad.push_back(BadSectors(a.range.file,
+                                 a.range.start + missing[j].first,
+                                 missing[j].second - missing[j].first));
+      cur = std::max(cur, missing[j].second);
+    }
+  }
+}
+
+void DVDCopy::copySectors(const DVDFileData * from, int fromStart,
+                          const DVDFileData * to, int toStart, int nb)
+{
+  if(interactive)
+    printf("Copying %d sectors of %s at %d to %s at %d\n", nb,
+           from->fileName().c_str(), fromStart, to->fileName().c_str(),
+           toStart);
+  progress.note("copy-sectors", to->fileName(true));
+  std::vector<char> buffer(nb * 2048);
+  DVDOutFile in(targetDirectory.c_str(), from->title, from->domain);
+  in.readSectors(fromStart, &buffer[0], nb);
+
+  DVDOutFile out(targetDirectory.c_str(), to->title, to->domain);
+  setupOutputFile(out);
+  out.seek(toStart);
+  out.writeSectors(&buffer[0], nb);
+  out.closeFile();
+  if(syncer)
+    syncer->syncFile(to->title, to->domain);
+}
+
+void DVDCopy::writeBadSectors(const std::vector<BadSectors> & list)
+{
+  // The file may still be open for appending the new bad sectors
+  closeBadSectorsFile();
+  if(syncer)
+    // The file is replaced atomically, so that there always is a
+    // complete one on disc
+    badSectors = fopen((badSectorsFileName + ".tmp").c_str(), "w");
+  else
     openBadSectorsFile("w");
-    for(int j = 0; j < badSectorsList.size(); j++)
-      fprintf(badSectors, "%s\n", badSectorsList[j].toString().c_str());
-    for(int j = i+1; j < oldBadSectors.size(); j++)
-      fprintf(badSectors, "%s\n", oldBadSectors[j].toString().c_str());
+  if(! badSectors) {
+    std::string err = "Could not write the bad sectors file '";
+    err += badSectorsFileName;
+    err += syncer ? ".tmp': " : "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  for(int i = 0; i < list.size(); i++)
+    fprintf(badSectors, "%s\n", list[i].toString().c_str());
+  if(syncer) {
+    fflush(badSectors);
+    fdatasync(fileno(badSectors));
     closeBadSectorsFile();
+    std::string tmp = badSectorsFileName + ".tmp";
+    if(rename(tmp.c_str(), badSectorsFileName.c_str()))
+      fprintf(stderr, "Could not replace '%s': %s\n",
+              badSectorsFileName.c_str(), strerror(errno));
+    else
+      // The later checkpoints rely on the new file
+      SyncThread::syncDirectory(badSectorsFileName);
   }
-  printf("\nAltogether, there are still %d missing sectors\n", 
-         totalMissing);
-  
+  closeBadSectorsFile();
+  // The list includes what was in the journal
+  unlink(badSectorsJournal().c_str());
+}
+
+std::string DVDCopy::badSectorsJournal()
+{
+  if(badSectorsFileName.empty())
+    badSectorsFileName = targetDirectory + ".bad";
+  return badSectorsFileName + ".journal";
 }
 
 void DVDCopy::scanForBadSectors(const char *device, 
                                 const char * badSectorsFile)
 {
   setup(device, NULL);
+  setPhase("scan");
+
+  long total = 0;
+  for(std::vector<DVDFileData *>::iterator i = files.begin(); 
+      i != files.end(); i++) {
+    const DVDFileData * dat = *i;
+    if(! (dat->dup || dat->isIFO()))
+      total += (dat->size + 2047)/2048;
+  }
+  progress.startRun(total);
 
   for(std::vector<DVDFileData *>::iterator i = files.begin(); 
       i != files.end(); i++) {
@@ -288,29 +757,20 @@ void DVDCopy::scanForBadSectors(const char *device,
     if(dat->domain == DVD_READ_INFO_FILE ||
        dat->domain == DVD_READ_INFO_BACKUP_FILE)
       continue;
-    std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+    std::unique_ptr<DVDFile> file(openFile(dat));
     int sz = file->fileSize();
 
-    auto success = [this](int blk, int nb, 
-                      unsigned char * buf,
-                      const DVDFileData * dat) {
-      for(int i = 0; i < nb; i++) {
-        unsigned char * buffer = buf + i * 2048;
-        int first_pes_offset = 13 + (buffer[13] & 0x7);
-        if(buffer[2] == 1 && buffer[first_pes_offset + 3] == 1)
-          continue;
-        else
-          registerBadSectors(dat, blk + i, 1, true);
-      }
-    };
-
-    auto failure = [this](int blk, int nb, 
-                      const DVDFileData * dat) {
-      registerBadSectors(dat, blk, nb, true);
-    };
-
-    file->walkFile(0, sz, (sectorsRead > 0 ? sectorsRead : -1), 
-                   success, failure);
+    auto bad = functionStage([](int blk, int nb, unsigned char * buffer,
+                                const DVDFileData * dat) {
+                             },
+                             [this](int blk, int nb,
+                                    const DVDFileData * dat) {
+                               registerBadSectors(dat, blk, nb, true);
+                             });
+    PackCheckStage<decltype(bad)> check(bad);
+    auto stages = pipeline(check);
+
+    file->walkFile(0, sz, (sectorsRead > 0 ? sectorsRead : -1), stages);
   }
 
   // OK, now, we have a list of bad sectors. We simplify it
@@ -329,11 +789,14 @@ void DVDCopy::scanForBadSectors(const char *device,
   for(int i = 0; i < simplifiedBad.size(); i++)
     fprintf(bad, "%s\n",
             simplifiedBad[i].toString().c_str());
+  setPhase("done");
+  writeStatistics();
 }
 
 void DVDCopy::spliceIFO(const char * device, const char * target, int nb)
 {
   setup(device, target);
+  setPhase("splice-ifos", target);
 
 
   DVDFileData * ifoFile = NULL;
@@ -369,33 +832,30 @@ void DVDCopy::spliceIFO(const char * device, const char * target, int nb)
     extractIFOSizes(ifo, &ifoSectors);
     DVDOutFile outfile(targetDirectory.c_str(), 
                        ifo->title, ifo->domain);
-    std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, bup));
-
-    int skipped = 0;
-    auto success = [&outfile](int offset, int nb, 
-                              unsigned char * buffer,
-                              const DVDFileData * dat) {
-      outfile.writeSectors(reinterpret_cast<char*>(buffer), nb);
-    };
-
-    auto failure = [&outfile, &skipped, this](int blk, int nb, 
-                                              const DVDFileData * dat) {
-      outfile.skipSectors(nb);
-      registerBadSectors(dat, blk, nb);
-      skipped += nb;
-    };
+    setupOutputFile(outfile);
+    std::unique_ptr<DVDFile> file(openFile(bup));
+
+    OutputStage output(outfile);
+    auto bad = functionStage([](int offset, int nb, unsigned char * buffer,
+                                const DVDFileData * dat) {
+                             },
+                             [this](int blk, int nb,
+                                    const DVDFileData * dat) {
+                               registerBadSectors(dat, blk, nb);
+                             });
+    auto stages = pipeline(bad, output);
 
     outfile.seek(nb);
-    file->walkFile(nb, ifoSectors - nb, 128, 
-                   success, failure);
+    file->walkFile(nb, ifoSectors - nb, 128, stages);
+    outfile.closeFile();
   }
 }
 
 
 DVDCopy::~DVDCopy()
 {
-  if(reader)
-    DVDClose(reader);
+  // Processes the last checkpoints, which need the bad sectors log
+  syncer.reset();
   closeBadSectorsFile();
   for(std::vector<DVDFileData *>::iterator i = files.begin(); 
       i != files.end(); i++)
@@ -413,6 +873,10 @@ void DVDCopy::openBadSectorsFile(const char * mode)
 
 void DVDCopy::closeBadSectorsFile()
 {
+  {
+    std::lock_guard<std::mutex> lock(badSectorsLogMutex);
+    badSectorsLog.reset();
+  }
   if(badSectors)
     fclose(badSectors);
   badSectors = NULL;
@@ -421,12 +885,33 @@ void DVDCopy::closeBadSectorsFile()
 void DVDCopy::registerBadSectors(const DVDFileData * dat, 
                                  int beg, int size, bool dontWrite)
 {
-  badSectorsList.push_back(BadSectors(dat, beg, size));
-  if(! dontWrite) {
-    openBadSectorsFile("a");
-    fprintf(badSectors, "%s\n",
-            badSectorsList.back().toString().c_str());
-    fflush(badSectors);
+  TRACE_SPAN("registerBadSectors");
+  BadSectors bs(dat, beg, size);
+  // Contiguous ranges (such as the sectors of an ECC block, retried
+  // one by one) are merged in the list, which is what is written
+  // when the file is rewritten.
+  if(badSectorsList.empty() || ! badSectorsList.back().tryMerge(bs))
+    badSectorsList.push_back(bs);
+  if(! dontWrite && journal) {
+    if(! badSectorsLog) {
+      if(badSectorsFileName.empty())
+        badSectorsFileName = targetDirectory + ".bad";
+      std::lock_guard<std::mutex> lock(badSectorsLogMutex);
+      badSectorsLog.reset(new BadSectorsLog(badSectorsFileName));
+    }
+    badSectorsLog->add(bs);
+  }
+}
+
+void DVDCopy::syncBadSectors()
+{
+  std::lock_guard<std::mutex> lock(badSectorsLogMutex);
+  if(badSectorsLog)
+    badSectorsLog->flush();
+  int fd = open(badSectorsFileName.c_str(), O_RDONLY);
+  if(fd >= 0) {
+    fdatasync(fd);
+    close(fd);
   }
 }
 
@@ -456,16 +941,49 @@ void DVDCopy::readBadSectors()
 {
   openBadSectorsFile("r");
   if(! badSectors) {
-    fprintf(stderr, "%s", "No bad sectors file found, "
-            "which is probably good news !\n");
+    if(interactive)
+      fprintf(stderr, "%s", "No bad sectors file found, "
+              "which is probably good news !\n");
     return;
   }
+  readBadSectorsLines(badSectors, &badSectorsList, NULL);
 
+  // What an interrupted run did since it last wrote the file
+  FILE * journal = fopen(badSectorsJournal().c_str(), "r");
+  if(! journal)
+    return;
+  std::vector<BadSectors> changes;
+  std::vector<char> signs;
+  readBadSectorsLines(journal, &changes, &signs);
+  fclose(journal);
+  if(interactive)
+    printf("Replaying %d changes from the journal '%s'\n",
+           (int) changes.size(), badSectorsJournal().c_str());
+  progress.note("journal", std::to_string(changes.size()));
+  for(int i = 0; i < changes.size(); i++) {
+    const BadSectors & c = changes[i];
+    if(signs[i] == '+') {
+      badSectorsList.push_back(c);
+      continue;
+    }
+    for(int j = 0; j < badSectorsList.size(); j++) {
+      const BadSectors & b = badSectorsList[j];
+      if(b.file == c.file && b.start == c.start && b.number == c.number) {
+        badSectorsList.erase(badSectorsList.begin() + j);
+        break;
+      }
+    }
+  }
+}
+
+void DVDCopy::readBadSectorsLines(FILE * file, std::vector<BadSectors> * list,
+                                  std::vector<char> * signs)
+{
   char buffer[1024];
   regex_t re;
-  regmatch_t matches[6];
+  regmatch_t matches[7];
   { 
-    int er = regcomp(&re, "[^:]+: *([0-9]+),([0-9]+),([0-9]+) *"
+    int er = regcomp(&re, "^([-+] )?[^:]+: *([0-9]+),([0-9]+),([0-9]+) *"
                      "([0-9]+) *\\(([0-9]+)\\)",
                      REG_EXTENDED);
     if(er) {
@@ -475,14 +993,14 @@ void DVDCopy::readBadSectors()
     }
   }
     
-  while(! feof(badSectors)) {
-    fgets(buffer, sizeof(buffer), badSectors);
+  while(fgets(buffer, sizeof(buffer), file)) {
     int status = regexec(&re, buffer, sizeof(matches)/sizeof(regmatch_t),
                          matches, 0);
     if(status) {
       fprintf(stderr, "error parsing line: %s", buffer);
     }
     else {
+      char sign = buffer[0];
       // Make all substrings NULL-terminated:
       for(int i = 1; i < sizeof(matches)/sizeof(regmatch_t); i++) {
         if(matches[i].rm_so >= 0)
@@ -490,24 +1008,294 @@ void DVDCopy::readBadSectors()
       }
       
       // No validation whatsoever, but all groups should be here anyway !
-      int title = atoi(buffer + matches[1].rm_so);
+      int title = atoi(buffer + matches[2].rm_so);
       dvd_read_domain_t domain = 
-        (dvd_read_domain_t) atoi(buffer + matches[2].rm_so);
-      int number = atoi(buffer + matches[3].rm_so);
+        (dvd_read_domain_t) atoi(buffer + matches[3].rm_so);
+      int number = atoi(buffer + matches[4].rm_so);
 
-      int beg = atoi(buffer + matches[4].rm_so);
-      int size = atoi(buffer + matches[5].rm_so);
+      int beg = atoi(buffer + matches[5].rm_so);
+      int size = atoi(buffer + matches[6].rm_so);
 
       int idx = findFile(title, domain, number);
       if(idx < 0) {
         fprintf(stderr, "Found no match for file %d,%d,%d\n",
                 title, domain, number);
       }
-      else
-        badSectorsList.push_back(BadSectors(files[idx], beg, size));
+      else {
+        list->push_back(BadSectors(files[idx], beg, size));
+        if(signs)
+          signs->push_back(matches[1].rm_so >= 0 ? sign : '+');
+      }
     }
   }
-  
+  regfree(&re);
+}
+
+DVDFile * DVDCopy::openFile(const DVDFileData * dat)
+{
+  // IFO files come from the cache, which records its own disc reads.
+  // The second pass tries again the sectors that failed so far.
+  if(dat->isIFO() && retrying)
+    ifoCache->refresh(dat);
+  DVDFile * file = dat->isIFO() ? ifoCache->openFile(dat) :
+    DVDFile::openFile(reader, dat);
+  if(file) {
+    if(! dat->isIFO())
+      file->setStatistics(&statistics);
+    file->setProgress(&progress);
+    file->setSharedResources(buffers, ioSlots);
+    file->setVOBUSkip(vobuSkip && ! retrying);
+    file->setECCRetries(retrying);
+  }
+  return file;
+}
+
+void DVDCopy::setSharedResources(BufferPool * b, IOSlots * s)
+{
+  buffers = b;
+  ioSlots = s;
+}
+
+void DVDCopy::setWriterPool(WriterPool * pool, WriterChannel * channel)
+{
+  writers = pool;
+  writerChannel = channel;
+}
+
+void DVDCopy::setupOutputFile(DVDOutFile & out)
+{
+  out.setStatistics(&statistics);
+  out.setWriterPool(writers, writerChannel);
+  out.setOutputFiles(outputFiles);
+  // The second pass writes in the middle of the files, it syncs them
+  // itself (see retryBadSectors())
+  if(! retrying)
+    out.setSyncThread(syncer.get());
+}
+
+void DVDCopy::setOutputFiles(OutputFiles * files)
+{
+  outputFiles = files;
+}
+
+void DVDCopy::setCatalog(DiscCatalog * c, DiscCatalog::Policy policy)
+{
+  catalog = c;
+  onArchived = policy;
+}
+
+void DVDCopy::setDriveProfiles(DriveProfiles * p, bool recal)
+{
+  profiles = p;
+  recalibrate = recal;
+}
+
+void DVDCopy::tuneReadSize()
+{
+  if(! profiles || sectorsRead > 0)
+    return;
+  std::string id = DVDDrive::identity(sourceDevice.c_str());
+  if(id.empty())
+    return;
+  DriveProfile profile;
+  if(! recalibrate && profiles->lookup(id, &profile)) {
+    if(interactive)
+      printf("Reading %d sectors at a time, as calibrated for %s\n",
+             profile.readSize, id.c_str());
+    progress.note("read-size", std::to_string(profile.readSize));
+    readSize = profile.readSize;
+    return;
+  }
+  if(interactive)
+    printf("Calibrating the read size for %s\n", id.c_str());
+  double throughput;
+  int size = calibrateReadSize(&throughput);
+  if(size < 0) {
+    if(interactive)
+      printf("Could not calibrate the read size, using the default\n");
+    return;
+  }
+  if(interactive)
+    printf("Best read size: %d sectors (%.1f MB/s)\n", size, throughput);
+  progress.note("read-size", std::to_string(size));
+  readSize = size;
+  profile.identity = id;
+  profile.readSize = size;
+  profile.throughput = throughput;
+  profile.date = time(NULL);
+  profile.uses = 0;
+  profiles->record(profile);
+}
+
+int DVDCopy::calibrateReadSize(double * throughput)
+{
+  static const int sizes[] = {16, 32, 64, 128, 256};
+  const int nbSizes = sizeof(sizes)/sizeof(int);
+
+  // Each size reads its own slice, so that neither the drive cache
+  // nor the kernel's favours the sizes tried last. Menu VOBs come
+  // first on the disc, so they are preferred.
+  const DVDFileData * dat = NULL;
+  for(int pass = 0; pass < 2 && ! dat; pass++) {
+    for(int i = 0; i < files.size(); i++) {
+      const DVDFileData * f = files[i];
+      if(f->dup || f->number > 1)
+        continue;
+      if(f->domain != (pass ? DVD_READ_TITLE_VOBS : DVD_READ_MENU_VOBS))
+        continue;
+      if(f->size/2048 >= 2 * nbSizes * 256) {
+        dat = f;
+        break;
+      }
+    }
+  }
+  if(! dat)
+    return -1;
+
+  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+  if(! file)
+    return -1;
+  int slice = std::min(file->fileSize() / (2 * nbSizes), 2560);
+  slice -= slice % 256;
+
+  // Two rounds, in opposite orders, to even out the drive spinning
+  // up.
+  std::vector<unsigned char> buffer(256 * 2048);
+  long times[nbSizes] = {0};
+  for(int round = 0; round < 2; round++) {
+    for(int j = 0; j < nbSizes; j++) {
+      int k = round ? nbSizes - 1 - j : j;
+      int start = (round * nbSizes + k) * slice;
+      long before = ReadStatistics::timestamp();
+      for(int done = 0; done < slice; done += sizes[k]) {
+        if(file->readBlocks(start + done, sizes[k], &buffer[0]) != sizes[k])
+          return -1;
+      }
+      times[k] += ReadStatistics::timestamp() - before;
+    }
+  }
+
+  double best = 0;
+  double rates[nbSizes];
+  for(int k = 0; k < nbSizes; k++) {
+    rates[k] = times[k] > 0 ? 2 * slice * 2048. / times[k] : 0;
+    best = std::max(best, rates[k]);
+  }
+  for(int k = 0; k < nbSizes; k++) {
+    if(rates[k] >= 0.95 * best) {
+      *throughput = rates[k];
+      return sizes[k];
+    }
+  }
+  return -1;
+}
+
+void DVDCopy::recordInCatalog(const std::string & fp)
+{
+  CatalogEntry entry;
+  entry.fingerprint = fp;
+  char * path = realpath(targetDirectory.c_str(), NULL);
+  entry.target = path ? path : targetDirectory;
+  free(path);
+  entry.badSectors = badSectorCount();
+  entry.date = time(NULL);
+  catalog->record(entry);
+}
+
+/// Hashes @a size bytes of @a data into @a hash, using 64 bits FNV-1a
+static void hashBytes(uint64_t & hash, const void * data, size_t size)
+{
+  const unsigned char * bytes = static_cast<const unsigned char *>(data);
+  for(size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+}
+
+std::string DVDCopy::fingerprint()
+{
+  TRACE_SPAN("fingerprint");
+  uint64_t hash = 14695981039346656037ULL;
+  long total = 0;
+  for(int i = 0; i < files.size(); i++) {
+    const DVDFileData * dat = files[i];
+    char buffer[200];
+    int len = snprintf(buffer, sizeof(buffer), "%d,%d,%d,%lu,%ld;",
+                       dat->title, dat->domain, dat->number,
+                       (unsigned long) dat->size, dat->startSector);
+    hashBytes(hash, buffer, len);
+    total += (dat->size + 2047)/2048;
+
+    if(dat->domain != DVD_READ_INFO_FILE)
+      continue;
+    int sz = ifoCache->fileSize(dat);
+    std::unique_ptr<unsigned char[]> data;
+    if(sz > 0 && ifoCache->complete(dat)) {
+      data.reset(new unsigned char[sz * 2048]);
+      ifoCache->readBlocks(dat, 0, sz, data.get());
+      hashBytes(hash, data.get(), sz * 2048);
+    }
+    else
+      hashBytes(hash, "unreadable", 10);
+  }
+  char buffer[100];
+  snprintf(buffer, sizeof(buffer), "%016llx-%ld",
+           (unsigned long long) hash, total);
+  return buffer;
+}
+
+long DVDCopy::badSectorCount() const
+{
+  long nb = 0;
+  for(int i = 0; i < badSectorsList.size(); i++)
+    nb += badSectorsList[i].number;
+  return nb;
+}
+
+void DVDCopy::setReadLog(const char * file)
+{
+  statistics.setReadLog(file);
+}
+
+void DVDCopy::addProgressSink(ProgressSink * sink)
+{
+  progress.addSink(sink);
+}
+
+void DVDCopy::setPhase(const char * phase, const std::string & detail)
+{
+  progress.setPhase(phase, detail);
+  statistics.setPhase(phase);
+}
+
+void DVDCopy::writeStatistics()
+{
+  if(syncer) {
+    syncer->flush();
+    if(interactive)
+      printf("Synced the copy %ld times, in %.1fs\n", syncer->syncs,
+             syncer->syncTime * 1e-6);
+    progress.note("synced", std::to_string(syncer->syncs));
+  }
+  if(interactive) {
+    statistics.displayHistograms();
+    statistics.displayReport();
+  }
+  if(! reportFile.empty()) {
+    if(interactive)
+      printf("Writing run report to '%s'\n", reportFile.c_str());
+    statistics.writeJSONReport(reportFile.c_str());
+  }
+  if(! latencyMapFile.empty()) {
+    if(interactive)
+      printf("Writing read latencies to '%s'\n", latencyMapFile.c_str());
+    statistics.writeLatencyMap(latencyMapFile.c_str(), files);
+  }
+  if(! heatmapFile.empty()) {
+    if(interactive)
+      printf("Writing latency heatmap to '%s'\n", heatmapFile.c_str());
+    statistics.writeHeatmap(heatmapFile.c_str(), files);
+  }
 }
 
 void DVDCopy::ejectDrive()
@@ -521,10 +1309,15 @@ void DVDCopy::extractIFOSizes(const DVDFileData * dat,
                               int * titleSectors)
 {
   unsigned char buffer[2048];
-  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
 
-  // Read the first sector
-  file->readBlocks(0, 1, buffer);
+  // Read the first sector, which is all we need
+  if(ifoCache->readBlocks(dat, 0, 1, buffer) != 1) {
+    if(titleSectors)
+      *titleSectors = -1;
+    if(ifoSectors)
+      *ifoSectors = -1;
+    return;
+  }
 
   // Information coming from:
   // http://dvd.sourceforge.net/dvdinfo/ifo.html
@@ -21,6 +21,22 @@
 #define __DVDCOPY_H
 
 #include "dvdreader.hh"
+#include "ifocache.hh"
+#include "readstats.hh"
+#include "progress.hh"
+#include "catalog.hh"
+#include "titlemap.hh"
+#include "syncthread.hh"
+
+class DVDFile;
+class DVDOutFile;
+class BufferPool;
+class IOSlots;
+class WriterPool;
+class WriterChannel;
+class OutputFiles;
+class DriveProfiles;
+class BadSectorsLog;
 
 /// Class representing a series of consecutive bad sectors.
 ///
@@ -49,6 +65,23 @@ public:
 };
 
 
+/// Bad sectors of a file that are the same sectors on the disc as
+/// those of another file, the owner. They are only tried through the
+/// owner, and get the outcome of the owner's sectors.
+class BadAlias {
+public:
+  /// The bad sectors
+  BadSectors range;
+
+  /// The owner, and where the same sectors start in there
+  const DVDFileData * owner;
+  int ownerStart;
+
+  BadAlias(const BadSectors & r, const DVDFileData * o, int os) :
+    range(r), owner(o), ownerStart(os) {;};
+};
+
+
 /// Handles the actual copying job, from a source to a target.
 class DVDCopy {
   /// Copies one file.
@@ -61,12 +94,27 @@ class DVDCopy {
   /// improve the usefulness ?
   ///
   /// it returns the number of skipped sectors.
-  int copyFile(const DVDFileData * dat, int start = 0, 
+  int copyFile(const DVDFileData * dat, int start = -1, 
                int nb = -1, int readNumber = -1);
 
-  /// The DVD device we're reading
+  /// Whether the bad sectors are being read again, in which case
+  /// reads go ECC block by ECC block, and then sector by sector (see
+  /// DVDFile::setECCRetries()).
+  bool retrying;
+
+  /// Whether registerBadSectors() appends to the bad sectors
+  /// file. Off when the file is kept up to date by a RetryRouter.
+  bool journal;
+
+  /// The source, opened only once by setup()
+  std::unique_ptr<DVDReader> source;
+
+  /// The DVD device we're reading, owned by source
   dvd_reader_t * reader;
 
+  /// The IFO and BUP files of the source, read only once
+  std::unique_ptr<IFOCache> ifoCache;
+
   /// The source device
   std::string sourceDevice;
   
@@ -78,9 +126,25 @@ class DVDCopy {
   FILE * badSectors;
 
 
-  /// Writes a bad sector list to the bad sectors file (unless
-  /// dontWrite is true), and add them to the badSectors list (in any
-  /// case).
+  /// Appends the bad sectors found to the bad sectors file, in the
+  /// background. Created with the first one.
+  std::unique_ptr<BadSectorsLog> badSectorsLog;
+
+  /// Protects the creation and destruction of the badSectorsLog
+  /// against syncBadSectors()
+  std::mutex badSectorsLogMutex;
+
+  /// Writes out the bad sectors found so far, and syncs the bad
+  /// sectors file. Called by the SyncThread before each checkpoint.
+  void syncBadSectors();
+
+  /// If not NULL, makes the output durable according to the
+  /// durability policy
+  std::unique_ptr<SyncThread> syncer;
+
+  /// Writes a bad sector list to the bad sectors file through the
+  /// badSectorsLog (unless dontWrite is true or journal is off), and
+  /// add them to the badSectors list (in any case).
   void registerBadSectors(const DVDFileData * dat, 
                           int beg, int size, 
                           bool dontWrite = false);
@@ -90,6 +154,81 @@ class DVDCopy {
   /// target, creating the target directories if necessary.
   void setup(const char * source, const char * target);
 
+  /// Sets up the target, creating the target directories if
+  /// necessary.
+  void setupTarget(const char * target);
+
+  /// Tries again to read the sectors listed in the bad sectors file,
+  /// and updates it. The ranges are tried in the order of their
+  /// expected yield, and the outcome is kept in the retry history.
+  void retryBadSectors();
+
+  /// If parts are selected, keeps in @a bad only what lies within
+  /// them, and moves the rest to @a outside.
+  void selectBadSectors(std::vector<BadSectors> & bad,
+                        std::vector<BadSectors> * outside);
+
+  /// Returns the sector of the disc at @a offset in the file, and
+  /// sets @a contiguous to the number of sectors that follow it on
+  /// the disc in the file (including it). Returns -1 if the file is
+  /// not at a known place on the disc.
+  long discSector(const DVDFileData * dat, int offset, int * contiguous);
+
+  /// Removes from @a bad the sectors that are the same on the disc as
+  /// those of a range earlier in the list, and lists them in @a
+  /// aliases, so that each sector of the disc is tried only once.
+  void aliasBadSectors(std::vector<BadSectors> & bad,
+                       std::vector<BadAlias> * aliases);
+
+  /// Gives the aliases the outcome of their owners: the sectors the
+  /// owners still have in @a bad are added there for the aliases, the
+  /// others are copied from the owner's output files.
+  void resolveAliases(const std::vector<BadAlias> & aliases,
+                      std::vector<BadSectors> & bad);
+
+  /// Copies sectors already written from an output file to another
+  void copySectors(const DVDFileData * from, int fromStart,
+                   const DVDFileData * to, int toStart, int nb);
+
+  /// Rewrites the bad sectors file with the given list
+  void writeBadSectors(const std::vector<BadSectors> & list);
+
+  /// If not NULL, the catalog of archived discs
+  DiscCatalog * catalog;
+
+  /// What to do when the disc is in the catalog already
+  DiscCatalog::Policy onArchived;
+
+  /// Where the disc was archived, if it is in the catalog
+  std::string archivedTarget;
+
+  /// Records the copy in the catalog, if there is one
+  void recordInCatalog(const std::string & fingerprint);
+
+  /// If not NULL, the read sizes calibrated for the drives
+  DriveProfiles * profiles;
+
+  /// Whether to calibrate the read size even if the drive has a valid
+  /// profile
+  bool recalibrate;
+
+  /// The number of sectors read in one go by the first pass, as
+  /// chosen by tuneReadSize(), or -1 for the default
+  int readSize;
+
+  /// Sets readSize from the profile of the drive, calibrating it if
+  /// there is none or if it is due for revalidation. Does nothing if
+  /// sectorsRead is set, if there are no profiles or if the source
+  /// isn't a drive.
+  void tuneReadSize();
+
+  /// Times reads of several sizes over the start of the first VOB
+  /// file large enough, and returns the smallest size whose
+  /// throughput (stored in @a throughput, in MB/s) is within 5% of
+  /// the best one. Returns -1 if the disc is too small or if a read
+  /// failed, as the timing is then meaningless.
+  int calibrateReadSize(double * throughput);
+
   /// The underlying files of the source
   std::vector<DVDFileData *> files;
 
@@ -97,9 +236,22 @@ class DVDCopy {
   /// or directly populated registerBadSectors
   std::vector<BadSectors> badSectorsList;
 
-  /// reads the bad sectors from the bad sectors file
+  /// reads the bad sectors from the bad sectors file, and applies
+  /// the journal left by an interrupted run, if there is one.
   void readBadSectors();
 
+  /// Parses bad sectors lines, as written by BadSectors::toString(),
+  /// into @a list. If @a signs isn't NULL, the lines may start with
+  /// "+ " or "- " (journal lines), and the signs are stored there.
+  void readBadSectorsLines(FILE * file, std::vector<BadSectors> * list,
+                           std::vector<char> * signs);
+
+  /// The journal of the changes to the bad sectors file, where the
+  /// ranges done are written with a "-" and those found bad with a
+  /// "+", when the file isn't rewritten after each range (see
+  /// RetryRouter). It is removed when the file is rewritten.
+  std::string badSectorsJournal();
+
   /// The name for the bad sectors file. It is constructed from the
   /// target if empty.
   std::string badSectorsFileName;
@@ -111,9 +263,51 @@ class DVDCopy {
   /// not to try to read from a descriptor open for writing.
   void openBadSectorsFile(const char * mode);
 
-  /// Closes the bad sectors file !
+  /// Closes the bad sectors file, and the log appending to it, once
+  /// it has written everything out.
   void closeBadSectorsFile();
 
+  /// Opens the given file from the source, and sets it up for
+  /// recording statistics. Returns NULL if the file can't be opened.
+  DVDFile * openFile(const DVDFileData * dat);
+
+  /// The timing of all the reads done so far
+  ReadStatistics statistics;
+
+  /// Where the progress is reported
+  Progress progress;
+
+  /// Whether the progress and the final report are displayed on the
+  /// terminal
+  bool interactive;
+
+  /// Resources shared with other copies, if not NULL
+  BufferPool * buffers;
+  IOSlots * ioSlots;
+
+  /// If not NULL, the output is written through that pool, on the
+  /// given channel
+  WriterPool * writers;
+  WriterChannel * writerChannel;
+
+  /// The output files, opened once for the whole run: either shared
+  /// ones, or those of this copy, created by setupTarget()
+  OutputFiles * outputFiles;
+  std::unique_ptr<OutputFiles> ownOutputFiles;
+
+  /// Sets up the output file for recording statistics and writing
+  /// through the writer pool.
+  void setupOutputFile(DVDOutFile & out);
+
+  /// Displays the latency histograms and the run report, and writes
+  /// out the latency map, the heatmap and the JSON report if
+  /// requested.
+  void writeStatistics();
+
+  /// Changes the phase of the run, both for the progress report and
+  /// the statistics.
+  void setPhase(const char * phase, const std::string & detail = "");
+
   /// Finds the index of the file referred to by the title, domain,
   /// number triplet. Returns -1 if not found.
   int findFile(int title, dvd_read_domain_t domain, int number);
@@ -125,20 +319,71 @@ class DVDCopy {
 
   /// Analyse a given IFO file to extract the relevant sector
   /// informations. It returns the number of sectors in the IFO file
-  /// and in the "title".
+  /// and in the "title", or -1 if the first sector of the IFO file
+  /// can't be read.
   ///
   /// A device must be setup already.
   void extractIFOSizes(const DVDFileData * file, 
                        int * ifoSectors,
                        int * titleSectors = NULL);
 
+  friend class RetryRouter;
+
 public:
 
-  DVDCopy();
+  /// Creates a copier. Non-@a interactive ones don't display their
+  /// progress or the final report on the terminal, which is what
+  /// one wants when several copies run at the same time.
+  DVDCopy(bool interactive = true);
 
   /// Sets the bad sectors file name
   void setBadSectorsFileName(const char * file);
 
+  /// Logs all the read attempts to the given file (see ReadLog)
+  void setReadLog(const char * file);
+
+  /// Uses the given catalog: discs found in there are handled
+  /// according to @a policy, and the copies are recorded there.
+  void setCatalog(DiscCatalog * catalog, DiscCatalog::Policy policy);
+
+  /// Uses the given drive profiles to pick the read size of the first
+  /// pass, calibrating it if needed, or always if @a recalibrate is
+  /// true.
+  void setDriveProfiles(DriveProfiles * profiles, bool recalibrate = false);
+
+  /// Computes a fingerprint of the disc, from the contents of the IFO
+  /// files and the sizes and start sectors of all the files. Reading
+  /// the IFO files only takes a fraction of a second.
+  ///
+  /// The source must be setup already.
+  std::string fingerprint();
+
+  /// If the disc was found in the catalog, the directory it was
+  /// archived to, or an empty string.
+  const std::string & archivedCopy() const { return archivedTarget; };
+
+  /// Adds a sink to which the progress is reported, on top of the
+  /// terminal. It will be deleted with this object.
+  void addProgressSink(ProgressSink * sink);
+
+  /// Shares the read buffers and I/O slots with other copies running
+  /// concurrently.
+  void setSharedResources(BufferPool * buffers, IOSlots * ioSlots);
+
+  /// Writes the output through the given pool and channel rather than
+  /// directly.
+  void setWriterPool(WriterPool * pool, WriterChannel * channel);
+
+  /// Writes the output to the given files, shared with other copies
+  /// to the same target.
+  void setOutputFiles(OutputFiles * files);
+
+  /// The timing of the reads done so far
+  const ReadStatistics & readStatistics() const { return statistics; };
+
+  /// The number of bad sectors found so far
+  long badSectorCount() const;
+
   /// Copies from source device to destination directory. The target
   /// directory should probably not exist.
   void copy(const char * source, const char * dest);
@@ -165,6 +410,44 @@ public:
   /// Number of sectors read in one go (in the normal operations)
   int sectorsRead;
 
+  /// Whether read errors in VOB files skip to the next VOBU (see
+  /// DVDFile::setVOBUSkip()). On by default.
+  bool vobuSkip;
+
+  /// When the output is made durable, so that the copy can be resumed
+  /// after a power loss (see SyncThread). None by default.
+  SyncThread::Policy durability;
+
+  /// The interval between two checkpoints of the Periodic
+  /// durability, in seconds
+  double syncInterval;
+
+  /// Whether the copy also checks that the VOB sectors read are MPEG
+  /// packs (see PackCheckStage), and lists those that aren't as bad
+  /// sectors, so that the second pass reads them again. Off by
+  /// default.
+  bool checkPacks;
+
+  /// The second pass gives up on ranges that failed that many times
+  /// in a row (see RetryHistory). 0 to never give up.
+  int maxRetryFailures;
+
+  /// If not empty, the second pass only retries the bad sectors of
+  /// the title VOBs within these parts of the titles.
+  std::vector<TitlePart> parts;
+
+  /// If not empty, the file in which the latency of every read is
+  /// written
+  std::string latencyMapFile;
+
+  /// If not empty, the PPM file in which a heatmap of the read
+  /// latencies over the disc surface is rendered
+  std::string heatmapFile;
+
+  /// If not empty, the file in which the run report is written in
+  /// JSON format
+  std::string reportFile;
+
 
   ~DVDCopy();
 };
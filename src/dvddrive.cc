@@ -23,9 +23,11 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <limits.h>
 
 #ifdef HAVE_LINUX_CDROM_H
 #include <linux/cdrom.h>
@@ -55,3 +57,74 @@ void DVDDrive::eject(const char * drive)
   close(fd);
 #endif
 }
+
+bool DVDDrive::isDrive(const char * drive)
+{
+#ifndef HAVE_LINUX_CDROM_H
+  return false;
+#else
+  int fd = open(drive, O_RDONLY|O_NONBLOCK);
+  if(fd < 0)
+    return false;
+  bool ret = ioctl(fd, CDROM_DRIVE_STATUS, CDSL_CURRENT) >= 0;
+  close(fd);
+  return ret;
+#endif
+}
+
+bool DVDDrive::waitForMedia(const char * drive, double timeout)
+{
+#ifdef HAVE_LINUX_CDROM_H
+  for(double waited = 0; waited < timeout; waited += 1) {
+    int fd = open(drive, O_RDONLY|O_NONBLOCK);
+    if(fd < 0)
+      return false;
+    int status = ioctl(fd, CDROM_DRIVE_STATUS, CDSL_CURRENT);
+    close(fd);
+    if(status < 0 || status == CDS_DISC_OK)
+      return true;
+    sleep(1);
+  }
+  return false;
+#else
+  return true;
+#endif
+}
+
+/// Reads the first line of a sysfs attribute, without the trailing
+/// spaces.
+static std::string readAttribute(const std::string & file)
+{
+  FILE * f = fopen(file.c_str(), "r");
+  if(! f)
+    return std::string();
+  char buffer[256];
+  std::string ret;
+  if(fgets(buffer, sizeof(buffer), f))
+    ret = buffer;
+  fclose(f);
+  size_t end = ret.find_last_not_of(" \t\n");
+  return end == std::string::npos ? std::string() : ret.substr(0, end + 1);
+}
+
+std::string DVDDrive::identity(const char * drive)
+{
+  struct stat st;
+  if(stat(drive, &st) || ! S_ISBLK(st.st_mode))
+    return std::string();
+  char buffer[100];
+  snprintf(buffer, sizeof(buffer), "/sys/dev/block/%u:%u/device/",
+           major(st.st_rdev), minor(st.st_rdev));
+  std::string dir = buffer;
+  std::string id = readAttribute(dir + "vendor");
+  std::string model = readAttribute(dir + "model");
+  std::string rev = readAttribute(dir + "rev");
+  if(model.empty())
+    return std::string();
+  if(! id.empty())
+    id += " ";
+  id += model;
+  if(! rev.empty())
+    id += " " + rev;
+  return id;
+}
@@ -26,6 +26,19 @@ public:
 
   /// Ejects the target drive
   static void eject(const char * drive);
+
+  /// Whether @a drive is an optical drive (as opposed to an image or
+  /// a directory)
+  static bool isDrive(const char * drive);
+
+  /// Waits for a disc to be ready in the drive, for at most @a
+  /// timeout seconds. Returns false if there was still none by then.
+  /// Sources that are not drives are always ready.
+  static bool waitForMedia(const char * drive, double timeout);
+
+  /// The vendor, model and firmware revision of the drive, as found
+  /// in sysfs, or an empty string if @a drive isn't a drive.
+  static std::string identity(const char * drive);
 };
 
 
@@ -20,6 +20,11 @@
 #include "headers.hh"
 #include "dvdfile.hh"
 #include "dvdreader.hh"
+#include "readstats.hh"
+#include "stages.hh"
+#include "progress.hh"
+#include "trace.hh"
+#include "pool.hh"
 
 /* For stat(2), open(2) and comrades... */
 #include <sys/types.h>
@@ -31,11 +36,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include <sys/time.h>
-
+#include <algorithm>
 
 #define SECTOR_SIZE 2048
 
+/// The number of sectors the error correction of DVDs works on
+#define ECC_BLOCK 16
+
 
 
 /// Files that work byte-by-byte
@@ -43,6 +50,7 @@ class DVDByteFile : public DVDFile {
   int blockOffset;
 public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) {
+    TRACE_SPAN("readBlocks");
     if(offset != blockOffset) {
       /// @todo error handling here.
       DVDFileSeek(file, offset * SECTOR_SIZE);
@@ -70,6 +78,7 @@ public:
 class DVDBlockFile : public DVDFile {
 public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) {
+    TRACE_SPAN("readBlocks");
     return DVDReadBlocks(file, offset, blocks, dest);
   }
 
@@ -85,14 +94,16 @@ public:
 //////////////////////////////////////////////////////////////////////
 
 DVDFile::DVDFile(dvd_file_t * f, const DVDFileData * d) :
-  file(f), dat(d)
+  file(f), dat(d), statistics(NULL), progress(NULL),
+  buffers(NULL), ioSlots(NULL), vobuSkip(true), eccRetries(false)
 {
-  // file shouldn't be 0 !
+  // file is only 0 for files that don't read from the disc directly
 }
 
 DVDFile::~DVDFile()
 {
-  DVDCloseFile(file);
+  if(file)
+    DVDCloseFile(file);
 }
 
 
@@ -103,6 +114,7 @@ int DVDFile::fileSize()
 
 DVDFile * DVDFile::openFile(dvd_reader_t * reader, const DVDFileData * dat)
 {
+  TRACE_SPAN("openFile");
   dvd_file_t * file = DVDOpenFile(reader, dat->title, dat->domain);
   if(! file)
     return NULL;
@@ -122,28 +134,68 @@ DVDFile * DVDFile::openFile(dvd_reader_t * reader, const DVDFileData * dat)
 }
 
 
-void DVDFile::walkFile(int start, int blocks, int steps, 
-                       const std::function<void (int offset, int nb, 
-                                                 unsigned char * buffer,
-                                                 const DVDFileData * dat)> & 
-                         successfulRead,
-                       const std::function<void (int offset, int nb, 
-                                                 const DVDFileData * dat)> & 
-                         failedRead)
+/// Reads a big endian 32 bits number
+static uint32_t read32(const unsigned char * p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+    ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/// Whether the sector is a NAV pack: a pack header, and the DSI
+/// packet (private stream 2, substream 1) at 0x400.
+static bool isNavPack(const unsigned char * sector)
 {
-  /* Data structures necessary for progress report */
-  struct timeval init;
-  struct timeval current;
+  static const unsigned char pack[] = { 0, 0, 1, 0xBA };
+  static const unsigned char stream2[] = { 0, 0, 1, 0xBF };
+  return ! memcmp(sector, pack, 4) &&
+    ! memcmp(sector + 0x400, stream2, 4) && sector[0x406] == 1;
+}
+
+void DVDFile::scanNavPacks(int blk, int nb, const unsigned char * buffer)
+{
+  for(int i = nb - 1; i >= 0; i--) {
+    const unsigned char * sector = buffer + i * SECTOR_SIZE;
+    if(! isNavPack(sector))
+      continue;
+
+    // Information coming from:
+    // http://dvd.sourceforge.net/dvdinfo/dsi_pkt.html
+    //
+    // Offsets are relative to the NAV pack, with flags in the upper
+    // two bits; 0x3fffffff means there is no such VOBU in the cell.
+    const unsigned char * dsi = sector + 0x407;
+    int nav = blk + i;
+    nextVOBUs.clear();
+    nextVOBUs.push_back(nav + (read32(dsi + 8) & 0x3fffffff) + 1);
+    for(int j = 0; j < 20; j++) {
+      // fwda[0..18] (240s to 1s ahead), then next_vobu
+      uint32_t ptr = read32(dsi + 238 + 4 * j) & 0x3fffffff;
+      if(ptr && ptr != 0x3fffffff)
+        nextVOBUs.push_back(nav + ptr);
+    }
+    std::sort(nextVOBUs.begin(), nextVOBUs.end());
+    nextVOBUs.erase(std::unique(nextVOBUs.begin(), nextVOBUs.end()),
+                    nextVOBUs.end());
+    return;
+  }
+}
 
-  double elapsed_seconds;
-  double estimated_seconds;
-  double rate;
-  const char * rate_suffix;
+int DVDFile::timedRead(int blk, int nb, unsigned char * buffer)
+{
+  IOSlots::Slot slot(ioSlots);
+  long before = ReadStatistics::timestamp();
+  int read = readBlocks(blk, nb, buffer);
+  if(statistics)
+    statistics->recordRead(dat, blk, nb, read,
+                           ReadStatistics::timestamp() - before);
+  return read;
+}
 
+void DVDFile::walkFile(int start, int blocks, int steps, ReadSink & sink)
+{
   if(steps < 0)
     steps = 128;                // Decent default ?
-  std::unique_ptr<unsigned char[]> 
-    readBuffer(new unsigned char[steps * SECTOR_SIZE]); 
+  BufferPool::Buffer readBuffer(buffers, steps);
 
   int overallSize = fileSize();
   int remaining = overallSize - start;
@@ -152,57 +204,76 @@ void DVDFile::walkFile(int start, int blocks, int steps,
   int read;
   if(blocks < remaining)
     remaining = blocks;
+  bool navPacks = vobuSkip && (dat->domain == DVD_READ_TITLE_VOBS ||
+                               dat->domain == DVD_READ_MENU_VOBS);
+  nextVOBUs.clear();
 
-  /// @todo Correct error handling
-  gettimeofday(&init, NULL);
-  printf("\nReading %d sectors at a time\n", steps); 
+  // The position of the file on the disc, as far as ECC blocks are
+  // concerned; unknown for directories.
+  int eccBase = dat->startSector >= 0 ? dat->startSector % ECC_BLOCK : 0;
+
+  // Up to there, read sector by sector (in an ECC block whose whole
+  // read failed but not that of its first sector).
+  int singleUntil = -1;
+
+  if(progress)
+    progress->startFile(dat, start, start + remaining, overallSize, steps);
   while(remaining > 0) {
     /* First, we determine the number of blocks to be read */
     if(remaining > steps)
       nb = steps;
     else
       nb = remaining;
+
+    if(blk < singleUntil)
+      nb = 1;
+    else if(steps >= ECC_BLOCK && nb < remaining) {
+      // Make the read end on an ECC block boundary
+      int end = (eccBase + blk + nb) % ECC_BLOCK;
+      if(end < nb)
+        nb -= end;
+    }
 	  
-    std::string fileName = dat->fileName(true, blk);
-    printf("\rReading block %7d/%d (%s)", 
-           blk, overallSize, fileName.c_str());
-    read = readBlocks(blk, nb, (unsigned char*) readBuffer.get());
+    if(progress)
+      progress->reading(blk);
+    read = timedRead(blk, nb, readBuffer.get());
+
+    if(read < 0 && eccRetries && nb > 1 && nb <= ECC_BLOCK) {
+      // All the sectors of an ECC block usually fail together, so
+      // that the others aren't tried one by one unless the first one
+      // can be read.
+      read = timedRead(blk, 1, readBuffer.get());
+      if(read > 0)
+        singleUntil = blk + nb;
+    }
 
     if(read < 0) {
       /* There was an error reading the file. */
-      printf("\nError while reading block %d of file %s, skipping\n",
-             blk, fileName.c_str());
-      failedRead(blk, nb, dat);
+      if(navPacks) {
+        // Skip up to the first VOBU starting after the failed read,
+        // if known
+        std::vector<int>::iterator next =
+          std::lower_bound(nextVOBUs.begin(), nextVOBUs.end(), blk + nb);
+        if(next != nextVOBUs.end())
+          nb = std::min(*next - blk, remaining);
+      }
+      if(progress)
+        progress->readError(blk, nb);
+      sink.error(blk, nb, dat);
       read = nb;
     }
-    else 
-      successfulRead(blk, read, readBuffer.get(), dat);
+    else {
+      if(navPacks)
+        scanNavPacks(blk, read, readBuffer.get());
+      sink.data(blk, read, readBuffer.get(), dat);
+    }
 
     remaining -= read;
     blk += read;
 
-    // Progress report
-    gettimeofday(&current, NULL);
-
-    elapsed_seconds = (current.tv_sec - init.tv_sec)*1.0 + 
-      1e-6 * (current.tv_usec - init.tv_usec);
-    estimated_seconds = (elapsed_seconds * (remaining + blk - start))/
-      (blk - start);
-    rate = ((blk - start) * 2048.)/(elapsed_seconds);
-    if(rate >= 1e6) {
-      rate_suffix = "MB/s";
-      rate /= 1e6;
-    }
-    else if(rate >= 1e3) {
-      rate_suffix = "kB/s";
-      rate /= 1e3;
-    }
-    else 
-      rate_suffix = "B/s";
-    printf(" (%02d:%02d out of %02d:%02d, %5.1f%s)", 
-           ((int) elapsed_seconds) / 60, ((int) elapsed_seconds) % 60, 
-           ((int) estimated_seconds) / 60, ((int) estimated_seconds) % 60,
-           rate, rate_suffix);
-    fflush(stdout);
+    if(progress)
+      progress->advance(blk);
   }
+  if(progress)
+    progress->finishFile();
 }
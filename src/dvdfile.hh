@@ -21,6 +21,11 @@
 #define __DVDFILE_H
 
 class DVDFileData;
+class ReadStatistics;
+class Progress;
+class BufferPool;
+class IOSlots;
+class ReadSink;
 
 /// Handles reading input files.
 class DVDFile {
@@ -32,6 +37,38 @@ protected:
   /// And a DVDFileData for output purposes
   const DVDFileData * dat;
 
+  /// If not NULL, where the latency of the reads done in walkFile
+  /// are recorded.
+  ReadStatistics * statistics;
+
+  /// If not NULL, where the progress of walkFile is reported.
+  Progress * progress;
+
+  /// If not NULL, the pool the read buffer of walkFile is taken from
+  BufferPool * buffers;
+
+  /// If not NULL, limits the number of concurrent reads
+  IOSlots * ioSlots;
+
+  /// Whether walkFile skips damaged areas up to the next VOBU
+  bool vobuSkip;
+
+  /// Whether walkFile tries the sectors of a failed ECC block one by
+  /// one
+  bool eccRetries;
+
+  /// The start of the VOBUs following the last NAV pack read by
+  /// walkFile, in increasing order.
+  std::vector<int> nextVOBUs;
+
+  /// Reads, recording the latency in the statistics, if any, and
+  /// holding an I/O slot.
+  int timedRead(int blk, int nb, unsigned char * buffer);
+
+  /// Looks for the last NAV pack in the @a nb sectors of @a buffer
+  /// read at @a blk, and updates nextVOBUs from its pointers.
+  void scanNavPacks(int blk, int nb, const unsigned char * buffer);
+
   DVDFile(dvd_file_t * f, const DVDFileData * d);
 
 public:
@@ -41,7 +78,10 @@ public:
   virtual int readBlocks(int offset, int blocks, unsigned char * dest) = 0;
 
   /// Returns the size of the file in blocks
-  int fileSize();
+  virtual int fileSize();
+
+  /// The file being read
+  const DVDFileData * fileData() const { return dat; };
 
 
   /// Opens the given file. This returns something that should be
@@ -54,19 +94,47 @@ public:
   /// nicer to make it part of DVDFileData ?
   static DVDFile * openFile(dvd_reader_t * reader, const DVDFileData * dat);
 
+  /// Sets the object in which read latencies are recorded.
+  void setStatistics(ReadStatistics * stats) { statistics = stats; };
+
+  /// Sets the object progress is reported to.
+  void setProgress(Progress * p) { progress = p; };
+
+  /// Whether read errors in VOB files skip directly to the next
+  /// VOBU named by the last NAV pack read, rather than just the
+  /// sectors that failed. On by default.
+  void setVOBUSkip(bool skip) { vobuSkip = skip; };
+
+  /// Whether, when the read of a whole ECC block (or less) fails,
+  /// walkFile tries its first sector alone, and then the others one
+  /// by one if that succeeds. Off by default, in which case the
+  /// sectors of the failed read are just skipped.
+  void setECCRetries(bool retries) { eccRetries = retries; };
+
+  /// Shares the read buffers and the I/O slots with other copies
+  /// running concurrently. Either can be NULL.
+  void setSharedResources(BufferPool * b, IOSlots * s) {
+    buffers = b;
+    ioSlots = s;
+  };
+
   virtual ~DVDFile();
 
   /// This functions reads @a blocks of blocks starting at @a start,
-  /// by reads of @a steps block and runs the given functions upon
-  /// successful reads and failed reads.
-  void walkFile(int start, int blocks, int steps, 
-                const std::function<void (int offset, int nb, 
-                                          unsigned char * buffer,
-                                          const DVDFileData * dat)> & 
-                successfulRead,
-                const std::function<void (int offset, int nb, 
-                                          const DVDFileData * dat)> & 
-                failedRead);
+  /// by reads of @a steps block and hands the outcome of each read to
+  /// @a sink, usually a Pipeline of stages.
+  ///
+  /// When @a steps is at least 16, reads are cut so that they end on
+  /// ECC block boundaries (of 16 sectors), as a defect makes the
+  /// whole ECC block fail. This uses the position of the file on the
+  /// disc, when it is known.
+  ///
+  /// For VOB files, when a read fails, the area skipped extends to
+  /// the start of the first VOBU after the failed read, as given by
+  /// the last NAV pack read (see setVOBUSkip()). Consecutive failures
+  /// skip to the VOBUs further away it lists, so finding the end of a
+  /// damaged area takes no extra reads.
+  void walkFile(int start, int blocks, int steps, ReadSink & sink);
 };
 
 
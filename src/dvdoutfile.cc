@@ -20,6 +20,11 @@
 #include "headers.hh"
 #include "dvdoutfile.hh"
 #include "dvdreader.hh"
+#include "trace.hh"
+#include "readstats.hh"
+#include "writerpool.hh"
+#include "outputfiles.hh"
+#include "syncthread.hh"
 
 /* For stat(2), open(2) and comrades... */
 #include <sys/types.h>
@@ -32,7 +37,7 @@
 #include <stdio.h>
 
 /** The maximum size of a file, in sectors */
-#define MAX_FILE_SIZE (512*1024)
+#define MAX_FILE_SIZE OutputFiles::partSectors
 #define SECTOR_SIZE 2048
 
 
@@ -53,63 +58,91 @@ std::string DVDOutFile::outputFileName(int number) const
 
 DVDOutFile::DVDOutFile(const char * output_dir, int t, 
                        dvd_read_domain_t d) :
-  outputDirectory(output_dir), title(t), domain(d), sector(0), fd(-1)
+  outputDirectory(output_dir), title(t), domain(d), sector(0),
+  statistics(NULL), writers(NULL), channel(NULL), files(NULL),
+  syncer(NULL), checkpointed(0), checkpointTime(ReadStatistics::timestamp())
 {
   
 }
 
-void DVDOutFile::openFile()
+void DVDOutFile::setOutputFiles(OutputFiles * f)
 {
-  off_t pos;
-  std::string name = outputFileName();
-
-  /* Closing to avoid unclosed files */
-  if(fd >= 0)
-    close(fd);
-  fd = open(name.c_str(), O_CREAT|O_WRONLY, 0666);
-  if(fd <= 0) {
-    std::string err("Failed to open output file '");
-    err += name + "': " + strerror(errno);
-    throw std::runtime_error(err);
-  }
-  /* Now, we seek to the position specified by sector */
-  pos = SECTOR_SIZE * (sector % MAX_FILE_SIZE);
-  lseek(fd, pos, SEEK_SET);
+  if(! f)
+    return;
+  closeFile();
+  std::lock_guard<std::mutex> lock(mutex);
+  files = f;
 }
 
-
 void DVDOutFile::writeSectors(const char * data, size_t number)
 {
-  if(fd < 0)
-    openFile();
-  int cur_sect_pos = sector % MAX_FILE_SIZE;
-  if(cur_sect_pos + number <= MAX_FILE_SIZE) {
-    /* Simple case */
-    write(fd, data, number * SECTOR_SIZE);
-    sector += number;
-
-    /* If we reached the end of file, we switch to the next one. */
-    if(sector % MAX_FILE_SIZE == 0)
-      openFile();
+  writeSectorsAt(sector, data, number);
+  sector += number;
+}
+
+void DVDOutFile::writeSectorsAt(int s, const char * data, size_t number)
+{
+  TRACE_SPAN("writeSectors");
+  OutputFiles * out;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(! files) {
+      ownFiles.reset(new OutputFiles(outputDirectory));
+      files = ownFiles.get();
+    }
+    out = files;
   }
-  else {
-    int left = MAX_FILE_SIZE - cur_sect_pos;
-    writeSectors(data, left);
-    writeSectors(data + SECTOR_SIZE * left, number - left);
+  long before = ReadStatistics::timestamp();
+  out->writeSectors(title, domain, s, data, number, writers, channel);
+  long after = ReadStatistics::timestamp();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(statistics)
+    statistics->recordWrite(number, after - before);
+  if(syncer) {
+    int end = s + number;
+    if(syncer->policy == SyncThread::PerPart &&
+       domain == DVD_READ_TITLE_VOBS &&
+       end / MAX_FILE_SIZE > checkpointed / MAX_FILE_SIZE)
+      checkpoint(end - end % MAX_FILE_SIZE);
+    else if(syncer->policy == SyncThread::Periodic &&
+            after - checkpointTime >= syncer->interval * 1e6)
+      checkpoint(end);
   }
 }
 
+void DVDOutFile::checkpoint(int s)
+{
+  if(writers && files)
+    writers->flush(channel);
+  syncer->checkpoint(title, domain, s);
+  checkpointed = s;
+  checkpointTime = ReadStatistics::timestamp();
+}
+
 void DVDOutFile::closeFile()
 {
-  if(fd >= 0)
-    close(fd);
-  fd = -1;
+  std::lock_guard<std::mutex> lock(mutex);
+  if(writers && files)
+    writers->flush(channel);
+  if(syncer && sector > checkpointed)
+    checkpoint(sector);
+  if(ownFiles) {
+    ownFiles.reset();
+    files = NULL;
+  }
 }
 
 
 DVDOutFile::~DVDOutFile()
 {
-  closeFile();
+  // Write errors must be caught by calling closeFile() beforehand
+  try {
+    closeFile();
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "%s\n", e.what());
+  }
 }
 
 std::string DVDOutFile::currentOutputName() const
@@ -121,13 +154,22 @@ std::string DVDOutFile::currentOutputName() const
 
 
 
-static char empty_sector[2048] = {0, 0, 0, 0};
+/// The number of sectors skipped in one write
+#define EMPTY_SECTORS 16
+static char empty_sectors[EMPTY_SECTORS * SECTOR_SIZE] = {0, 0, 0, 0};
 
 void DVDOutFile::skipSectors(size_t number)
 {
+  TRACE_SPAN("skipSectors");
   /// @todo Possibly we should fill this with relevant information ?
-  while(number--)
-    writeSectors(empty_sector, 1);
+  while(number > 0) {
+    size_t nb = number < EMPTY_SECTORS ? number : EMPTY_SECTORS;
+    writeSectors(empty_sectors, nb);
+    number -= nb;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  if(syncer && syncer->policy == SyncThread::PerBadRange)
+    checkpoint(sector);
 }
 
 size_t DVDOutFile::fileSize() const
@@ -151,9 +193,9 @@ size_t DVDOutFile::fileSize() const
     while(1) {
       name = outputFileName(cur);
       if(stat(name.c_str(), &fs) == -1)
-	return (cur - 1)*512*1024;
-      if(fs.st_size < (1024 * 1024 * 1024))
-	return (cur - 1)*512*1024 + fs.st_size/2048;
+	return (cur - 1)*MAX_FILE_SIZE;
+      if(fs.st_size < (off_t) MAX_FILE_SIZE * SECTOR_SIZE)
+	return (cur - 1)*MAX_FILE_SIZE + fs.st_size/2048;
       cur += 1;
     }
   }
@@ -163,5 +205,28 @@ size_t DVDOutFile::fileSize() const
 void DVDOutFile::seek(int s)
 {
   sector = s;
-  openFile();
+}
+
+size_t DVDOutFile::readSectors(int s, char * data, size_t number) const
+{
+  size_t done = 0;
+  while(done < number) {
+    int cur = s + done;
+    size_t nb = number - done;
+    if(cur % MAX_FILE_SIZE + nb > MAX_FILE_SIZE)
+      nb = MAX_FILE_SIZE - cur % MAX_FILE_SIZE;
+    std::string name = outputFileName(cur / MAX_FILE_SIZE + 1);
+    int in = open(name.c_str(), O_RDONLY);
+    if(in < 0)
+      break;
+    ssize_t rd = pread(in, data + done * SECTOR_SIZE, nb * SECTOR_SIZE,
+                       (off_t) SECTOR_SIZE * (cur % MAX_FILE_SIZE));
+    close(in);
+    if(rd <= 0)
+      break;
+    done += rd / SECTOR_SIZE;
+    if(rd < nb * SECTOR_SIZE)
+      break;
+  }
+  return done;
 }
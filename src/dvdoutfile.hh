@@ -20,11 +20,21 @@
 #ifndef __DVDOUTFILE_H
 #define __DVDOUTFILE_H
 
+#include <mutex>
+
+class ReadStatistics;
+class WriterPool;
+class WriterChannel;
+class OutputFiles;
+class SyncThread;
+
 /// Handles writing output files.
+///
+/// All the writes are positional, to file descriptors opened once for
+/// all the parts of the file (see OutputFiles): there is no seeking
+/// or reopening, even across the 1GB boundaries of title VOBs. The
+/// current sector is only a convenience for sequential writes.
 class DVDOutFile {
-  /// Output file descriptor
-  int fd;
-  
   /// Output directory
   std::string outputDirectory;
 
@@ -37,16 +47,40 @@ class DVDOutFile {
   /// Current sector (one DVD sector is 2048 bytes)
   int sector;
 
+  /// If not NULL, where the writes are accounted for
+  ReadStatistics * statistics;
+
+  /// If not NULL, the writes go through that pool, on the given
+  /// channel
+  WriterPool * writers;
+  WriterChannel * channel;
+
+  /// The output files: either shared ones, or those of this object
+  OutputFiles * files;
+  std::unique_ptr<OutputFiles> ownFiles;
+
+  /// If not NULL, where the checkpoints are sent, according to its
+  /// policy
+  SyncThread * syncer;
+
+  /// The last checkpoint sent, and when, in microseconds
+  int checkpointed;
+  long checkpointTime;
+
+  /// Protects the files, the statistics and the checkpoint state
+  /// against concurrent calls to writeSectorsAt()
+  std::mutex mutex;
+
+  /// Sends a checkpoint at @a sector, once the writes queued in the
+  /// pool (if any) are done. The mutex must be held.
+  void checkpoint(int sector);
+
   /// Returns the numbered base file
   std::string makeFileName(int number = -1) const;
 
   /// Returns the full output file name 
   std::string outputFileName(int number = -1) const;
 
-  /// Ensures the file descriptor is opened to the correct
-  /// file. Handles file changing correctly.
-  void openFile();
-
 public:
 
   /// Creates and opens an output file.
@@ -57,7 +91,14 @@ public:
   /// number of bytes.
   void writeSectors(const char * data, size_t number);
 
-  /// Closes the output file
+  /// Writes sectors at \p sector, without changing the current
+  /// sector. Can be called from several threads at once.
+  void writeSectorsAt(int sector, const char * data, size_t number);
+
+  /// Closes the output files, unless they are shared. When writing
+  /// through a pool, waits for all the data to be written first, and
+  /// throws if it could not. Sends the last checkpoint, if there is a
+  /// SyncThread.
   void closeFile();
 
   /// Returns the current file name (including the VIDEO_TS bit, but
@@ -74,6 +115,27 @@ public:
   /// Seeks to the given sector:
   void seek(int sector);
 
+  /// Reads back \p number sectors already written, starting at \p
+  /// sector. Returns the number of sectors read.
+  size_t readSectors(int sector, char * data, size_t number) const;
+
+  /// Sets the object in which writes are recorded.
+  void setStatistics(ReadStatistics * stats) { statistics = stats; };
+
+  /// Sends the writes to the given pool instead of writing directly.
+  void setWriterPool(WriterPool * pool, WriterChannel * chan) {
+    writers = pool;
+    channel = chan;
+  };
+
+  /// Writes to the given shared files rather than to files of its
+  /// own. Does nothing if @a files is NULL.
+  void setOutputFiles(OutputFiles * files);
+
+  /// Sends checkpoints to the given SyncThread as the sectors are
+  /// written sequentially, as its policy says, and at the end.
+  void setSyncThread(SyncThread * s) { syncer = s; };
+
   ~DVDOutFile();
 
   /// Returns the file name for the given attributes
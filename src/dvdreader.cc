@@ -26,6 +26,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
 
 bool DVDFileData::isBackup() const
 {
@@ -87,7 +89,8 @@ std::string DVDFileData::fileName(bool stripInitialSlash,
 
 //////////////////////////////////////////////////////////////////////
 
-DVDReader::DVDReader(const char * device) : source(device), isDir(false)
+DVDReader::DVDReader(const char * device) : source(device), isDir(false),
+                                            indexed(false)
 {
   reader = DVDOpen(device);
   if(! reader) {
@@ -100,6 +103,280 @@ DVDReader::DVDReader(const char * device) : source(device), isDir(false)
     if(S_ISDIR(sb.st_mode))
       isDir = true;
   }
+  indexed = isDir ? readDirectory() : readUDFDirectory();
+}
+
+/// Returns the upper-case version of the string
+static std::string upperCase(const char * str)
+{
+  std::string ret = str;
+  for(size_t i = 0; i < ret.size(); i++)
+    ret[i] = toupper(ret[i]);
+  return ret;
+}
+
+bool DVDReader::readDirectory()
+{
+  // Look for the VIDEO_TS directory regardless of the case
+  DIR * dir = opendir(source.c_str());
+  if(! dir)
+    return false;
+  std::string videoTS;
+  struct dirent * ent;
+  while((ent = readdir(dir))) {
+    if(upperCase(ent->d_name) == "VIDEO_TS") {
+      videoTS = source + "/" + ent->d_name;
+      break;
+    }
+  }
+  closedir(dir);
+  if(videoTS.empty())
+    return false;
+
+  dir = opendir(videoTS.c_str());
+  if(! dir)
+    return false;
+  while((ent = readdir(dir))) {
+    struct stat sb;
+    std::string file = videoTS + "/" + ent->d_name;
+    if(stat(file.c_str(), &sb) || ! S_ISREG(sb.st_mode))
+      continue;
+    DirEntry & e = directory[upperCase(ent->d_name)];
+    e.id = sb.st_ino;
+    e.start = -1;
+    e.size = sb.st_size;
+  }
+  closedir(dir);
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// UDF parsing. DVD-Video discs use UDF 1.02 (ECMA-167): only a
+// single partition, 2048-byte blocks and files recorded in a few
+// extents, which is all that is handled here.
+
+static uint16_t udf16(const unsigned char * p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t udf32(const unsigned char * p)
+{
+  return udf16(p) | ((uint32_t) udf16(p + 2) << 16);
+}
+
+static uint64_t udf64(const unsigned char * p)
+{
+  return udf32(p) | ((uint64_t) udf32(p + 4) << 32);
+}
+
+/// UDF descriptor tags
+enum {
+  UDFAnchor = 2,
+  UDFPartition = 5,
+  UDFLogicalVolume = 6,
+  UDFTerminator = 8,
+  UDFFileSet = 256,
+  UDFFileIdentifier = 257,
+  UDFFileEntry = 261,
+  UDFExtendedFileEntry = 266
+};
+
+/// Reads @a nb sectors at @a lba from @a fd, and checks the tag of
+/// the first one if @a tag is not negative. The file system is not
+/// scrambled, so that it can be read without libdvdread.
+static bool udfRead(int fd, uint32_t lba, int nb,
+                    unsigned char * buffer, int tag = -1)
+{
+  size_t len = (size_t) nb * DVD_VIDEO_LB_LEN;
+  off_t offset = (off_t) lba * DVD_VIDEO_LB_LEN;
+  if(pread(fd, buffer, len, offset) != (ssize_t) len)
+    return false;
+  return tag < 0 || udf16(buffer) == tag;
+}
+
+bool DVDReader::readUDFFile(int fd, uint32_t partition, uint32_t block,
+                            long * start, uint64_t * size,
+                            std::vector<unsigned char> * data)
+{
+  unsigned char fe[DVD_VIDEO_LB_LEN];
+  if(! udfRead(fd, partition + block, 1, fe))
+    return false;
+  int lea, lad, base;
+  if(udf16(fe) == UDFFileEntry) {
+    lea = udf32(fe + 168);
+    lad = udf32(fe + 172);
+    base = 176;
+  }
+  else if(udf16(fe) == UDFExtendedFileEntry) {
+    lea = udf32(fe + 208);
+    lad = udf32(fe + 212);
+    base = 216;
+  }
+  else
+    return false;
+  if(lea < 0 || lad < 0 || base + lea + lad > DVD_VIDEO_LB_LEN)
+    return false;
+
+  *size = udf64(fe + 56);
+  const unsigned char * ads = fe + base + lea;
+  int type = udf16(fe + 34) & 7;
+  if(type == 3) {
+    // Data embedded in the file entry
+    *start = partition + block;
+    if(data)
+      data->assign(ads, ads + std::min<uint64_t>(lad, *size));
+    return true;
+  }
+  if(type > 1)
+    return false;
+
+  // short_ad or long_ad; the partition reference of long_ad is
+  // ignored, as there is only one.
+  int adSize = (type == 0 ? 8 : 16);
+  *start = lad >= adSize ? partition + udf32(ads + 4) : 0;
+  if(! data)
+    return true;
+  data->clear();
+  for(int i = 0; i + adSize <= lad && data->size() < *size; i += adSize) {
+    uint32_t len = udf32(ads + i) & 0x3FFFFFFF;
+    if(! len)
+      break;
+    uint32_t nb = (len + DVD_VIDEO_LB_LEN - 1)/DVD_VIDEO_LB_LEN;
+    size_t cur = data->size();
+    data->resize(cur + nb * DVD_VIDEO_LB_LEN);
+    if(! udfRead(fd, partition + udf32(ads + i + 4), nb, &(*data)[cur]))
+      return false;
+    data->resize(cur + len);
+  }
+  if(data->size() < *size)
+    return false;
+  data->resize(*size);
+  return true;
+}
+
+/// A file identifier in a UDF directory
+class UDFFileIdent {
+public:
+  std::string name;
+  uint32_t block;
+  bool isDir;
+};
+
+/// Parses the contents of a UDF directory, skipping the parent and
+/// the deleted entries.
+static bool udfParseDirectory(const std::vector<unsigned char> & data,
+                              std::vector<UDFFileIdent> * files)
+{
+  size_t off = 0;
+  while(off + 38 <= data.size()) {
+    const unsigned char * fid = &data[off];
+    if(udf16(fid) != UDFFileIdentifier)
+      return false;
+    int flags = fid[18];
+    int lfi = fid[19];
+    int liu = udf16(fid + 36);
+    if(off + 38 + liu + lfi > data.size())
+      return false;
+    if(! (flags & 0x0C) && lfi > 0) {
+      // Names are either 8 or 16 bits (big endian) per character,
+      // the first byte telling which.
+      const unsigned char * id = fid + 38 + liu;
+      UDFFileIdent f;
+      if(id[0] == 8)
+        f.name.assign((const char *) id + 1, lfi - 1);
+      else if(id[0] == 16) {
+        for(int i = 2; i < lfi; i += 2)
+          f.name += (char) id[i];
+      }
+      f.block = udf32(fid + 24);
+      f.isDir = flags & 0x02;
+      files->push_back(f);
+    }
+    off += (38 + liu + lfi + 3) & ~3;
+  }
+  return true;
+}
+
+bool DVDReader::readUDFDirectory()
+{
+  int fd = open(source.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  bool ok = parseUDF(fd);
+  close(fd);
+  return ok;
+}
+
+bool DVDReader::parseUDF(int fd)
+{
+  unsigned char buf[DVD_VIDEO_LB_LEN];
+
+  // Anchor, then the volume descriptors for the partition start and
+  // the location of the file set descriptor.
+  if(! udfRead(fd, 256, 1, buf, UDFAnchor))
+    return false;
+  uint32_t vdsLength = udf32(buf + 16)/DVD_VIDEO_LB_LEN;
+  uint32_t vdsStart = udf32(buf + 20);
+  bool partFound = false, lvFound = false;
+  uint32_t partition = 0, fileSet = 0;
+  for(uint32_t i = 0; i < vdsLength && i < 64; i++) {
+    if(! udfRead(fd, vdsStart + i, 1, buf))
+      return false;
+    int tag = udf16(buf);
+    if(tag == UDFPartition) {
+      partition = udf32(buf + 188);
+      partFound = true;
+    }
+    else if(tag == UDFLogicalVolume) {
+      if(udf32(buf + 212) != DVD_VIDEO_LB_LEN)
+        return false;
+      fileSet = udf32(buf + 252);
+      lvFound = true;
+    }
+    else if(tag == UDFTerminator)
+      break;
+  }
+  if(! partFound || ! lvFound)
+    return false;
+
+  if(! udfRead(fd, partition + fileSet, 1, buf, UDFFileSet))
+    return false;
+
+  // Root directory, then VIDEO_TS
+  long start;
+  uint64_t size;
+  std::vector<unsigned char> data;
+  std::vector<UDFFileIdent> files;
+  if(! readUDFFile(fd, partition, udf32(buf + 404), &start, &size,
+                   &data) ||
+     ! udfParseDirectory(data, &files))
+    return false;
+  uint32_t videoTS = 0;
+  for(size_t i = 0; i < files.size(); i++) {
+    if(files[i].isDir && upperCase(files[i].name.c_str()) == "VIDEO_TS") {
+      videoTS = files[i].block;
+      break;
+    }
+  }
+  if(! videoTS)
+    return false;
+
+  files.clear();
+  if(! readUDFFile(fd, partition, videoTS, &start, &size, &data) ||
+     ! udfParseDirectory(data, &files))
+    return false;
+  for(size_t i = 0; i < files.size(); i++) {
+    if(files[i].isDir)
+      continue;
+    if(! readUDFFile(fd, partition, files[i].block, &start, &size, NULL))
+      return false;
+    DirEntry & e = directory[upperCase(files[i].name.c_str())];
+    e.id = start;
+    e.start = start;
+    e.size = size;
+  }
+  return true;
 }
 
 
@@ -108,7 +385,17 @@ DVDFileData * DVDReader::getFileInfo(int title,
                                      int number)
 {
   DVDFileData * data = new DVDFileData(title, domain, number);
-  if(isDir) {
+  if(indexed) {
+    std::map<std::string, DirEntry>::iterator it =
+      directory.find(DVDFileData::fileName(title, domain, number));
+    if(it != directory.end() && it->second.start) {
+      data->fileID = it->second.id;
+      data->startSector = it->second.start;
+      data->size = it->second.size;
+      return data;
+    }
+  }
+  else if(isDir) {
     struct stat sb;
     std::string file = source + data->fileName();
     if(! stat(file.c_str(), &sb)) {
@@ -124,6 +411,7 @@ DVDFileData * DVDReader::getFileInfo(int title,
     start = UDFFindFile(reader, buf, &size);
     if(start) {
       data->fileID = start;
+      data->startSector = start;
       data->size = size;
       return data;
     }
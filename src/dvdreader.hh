@@ -41,6 +41,10 @@ public:
   /// an image of inode number if using a directory)
   unsigned long fileID;
 
+  /// The first sector of the file on the disc, or -1 if that isn't
+  /// known (ie when reading from a directory).
+  long startSector;
+
   /// The size of the file
   uint32_t size;
 
@@ -53,7 +57,7 @@ public:
 
   DVDFileData(int t, dvd_read_domain_t d, 
               int n) : title(t), domain(d), number(n), 
-                       dup(NULL), relevantSize(0) {;};
+                       dup(NULL), startSector(-1), relevantSize(0) {;};
 
   std::string fileName(bool stripInitialSlash = false, 
                        int blocks = -1) const;
@@ -73,7 +77,11 @@ public:
 
 /// Wraps a dvdreader_t object.
 ///
-/// For now, it only provides introspection functions.
+/// It lists the files of the VIDEO_TS directory. The directory is
+/// read only once, when the reader is created: with a single readdir
+/// for directory sources, or by parsing the UDF file system for
+/// images and devices. When that is not possible, files are looked
+/// up one by one.
 class DVDReader {
 
 
@@ -86,6 +94,46 @@ class DVDReader {
   /// Whether the source is a directory or something else.
   bool isDir;
 
+  /// A file of the VIDEO_TS directory
+  class DirEntry {
+  public:
+    /// The inode number or the start sector
+    unsigned long id;
+
+    /// The start sector, or -1 for directory sources
+    long start;
+
+    /// The size of the file
+    uint32_t size;
+  };
+
+  /// The contents of the VIDEO_TS directory, by upper-case file
+  /// name.
+  std::map<std::string, DirEntry> directory;
+
+  /// Whether directory has been filled, in which case getFileInfo
+  /// only looks there.
+  bool indexed;
+
+  /// Fills directory by reading the VIDEO_TS directory of a directory
+  /// source. Returns false if that wasn't possible.
+  bool readDirectory();
+
+  /// Fills directory by parsing the UDF file system of an image or a
+  /// device, read directly from the source. Returns false if that
+  /// wasn't possible.
+  bool readUDFDirectory();
+
+  /// Does the work of readUDFDirectory(), reading the sectors from
+  /// the file descriptor @a fd.
+  bool parseUDF(int fd);
+
+  /// Reads the UDF file entry at the given logical block of the
+  /// partition starting at @a partition, from @a fd. Stores the first
+  /// sector of the file and its size, and reads its contents into @a
+  /// data if it isn't NULL. Returns false on failure.
+  bool readUDFFile(int fd, uint32_t partition, uint32_t block, long * start,
+                   uint64_t * size, std::vector<unsigned char> * data);
 
   /// Get information about the given file.
   ///
@@ -104,6 +152,11 @@ public:
   /// List all files present on the device
   std::vector<DVDFileData *> listFiles();
 
+  /// The underlying reader, which stays owned by this object.
+  dvd_reader_t * handle() const {
+    return reader;
+  };
+
 
   ~DVDReader();
 };
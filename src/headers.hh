@@ -28,6 +28,7 @@
 #include <vector>
 #include <array>
 #include <map>
+#include <deque>
 #include <memory>
 #include <functional>
 
@@ -0,0 +1,152 @@
+/**
+    \file ifocache.cc
+    Implementation of the IFOCache class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "ifocache.hh"
+#include "dvdfile.hh"
+#include "dvdreader.hh"
+#include "readstats.hh"
+#include "trace.hh"
+
+/// A DVDFile reading from an IFOCache
+class DVDCachedFile : public DVDFile {
+  IFOCache * cache;
+public:
+  DVDCachedFile(IFOCache * c, const DVDFileData * d) :
+    DVDFile(NULL, d), cache(c) {;};
+
+  virtual int readBlocks(int offset, int blocks, unsigned char * dest) {
+    return cache->readBlocks(dat, offset, blocks, dest);
+  };
+
+  virtual int fileSize() {
+    return cache->fileSize(dat);
+  };
+};
+
+//////////////////////////////////////////////////////////////////////
+
+IFOCache::IFOCache(dvd_reader_t * r, ReadStatistics * stats) :
+  reader(r), statistics(stats)
+{
+}
+
+int IFOCache::readDisc(DVDFile * file, Entry * e, int offset, int blocks)
+{
+  long before = ReadStatistics::timestamp();
+  int nb = file->readBlocks(offset, blocks, &e->data[offset * 2048]);
+  if(statistics)
+    statistics->recordRead(file->fileData(), offset, blocks, nb,
+                           ReadStatistics::timestamp() - before);
+  for(int i = 0; i < nb; i++)
+    e->good[offset + i] = true;
+  return nb;
+}
+
+void IFOCache::fill(DVDFile * file, Entry * e, int offset, int blocks)
+{
+  if(readDisc(file, e, offset, blocks) >= blocks)
+    return;
+  for(int i = offset; i < offset + blocks; i++)
+    if(! e->good[i] && readDisc(file, e, i, 1) < 1)
+      e->failed[i] = true;
+}
+
+IFOCache::Entry * IFOCache::entry(const DVDFileData * dat)
+{
+  std::pair<int, int> key(dat->title, dat->domain);
+  std::map<std::pair<int, int>, std::unique_ptr<Entry> >::iterator it =
+    entries.find(key);
+  if(it != entries.end())
+    return it->second.get();
+
+  TRACE_SPAN("loadIFO");
+  Entry * e = new Entry;
+  entries[key].reset(e);
+  std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+  e->opened = file.get() != NULL;
+  e->sectors = file ? file->fileSize() : 0;
+  if(! file)
+    return e;
+  e->data.resize(e->sectors * 2048);
+  e->good.assign(e->sectors, false);
+  e->failed.assign(e->sectors, false);
+  fill(file.get(), e, 0, e->sectors);
+  return e;
+}
+
+int IFOCache::fileSize(const DVDFileData * dat)
+{
+  Entry * e = entry(dat);
+  return e->opened ? e->sectors : -1;
+}
+
+bool IFOCache::complete(const DVDFileData * dat)
+{
+  Entry * e = entry(dat);
+  if(! e->opened)
+    return false;
+  for(int i = 0; i < e->sectors; i++)
+    if(! e->good[i])
+      return false;
+  return true;
+}
+
+int IFOCache::readBlocks(const DVDFileData * dat, int offset, int blocks,
+                         unsigned char * dest)
+{
+  Entry * e = entry(dat);
+  if(! e->opened)
+    return -1;
+  if(offset >= e->sectors)
+    return 0;
+  if(offset + blocks > e->sectors)
+    blocks = e->sectors - offset;
+
+  // Read the sectors not tried since the last refresh
+  for(int i = offset; i < offset + blocks; i++) {
+    if(! e->good[i] && ! e->failed[i]) {
+      std::unique_ptr<DVDFile> file(DVDFile::openFile(reader, dat));
+      if(file)
+        fill(file.get(), e, i, offset + blocks - i);
+      break;
+    }
+  }
+
+  int nb = 0;
+  while(nb < blocks && e->good[offset + nb])
+    nb++;
+  if(! nb)
+    return -1;
+  memcpy(dest, &e->data[offset * 2048], nb * 2048);
+  return nb;
+}
+
+void IFOCache::refresh(const DVDFileData * dat)
+{
+  Entry * e = entry(dat);
+  e->failed.assign(e->sectors, false);
+}
+
+DVDFile * IFOCache::openFile(const DVDFileData * dat)
+{
+  if(! entry(dat)->opened)
+    return NULL;
+  return new DVDCachedFile(this, dat);
+}
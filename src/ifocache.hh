@@ -0,0 +1,103 @@
+/**
+    \file ifocache.hh
+    The IFOCache class, keeping the IFO and BUP files in memory
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __IFOCACHE_H
+#define __IFOCACHE_H
+
+class DVDFile;
+class DVDFileData;
+class ReadStatistics;
+
+/// Keeps the IFO and BUP files of the source in memory, so that they
+/// are read from the disc only once per run, however many times they
+/// are parsed and copied. Reading marginal IFO sectors can take
+/// seconds on a scratched disc.
+///
+/// A file is loaded entirely the first time it is needed, sector by
+/// sector where the whole read fails. The sectors that could not be
+/// read are not tried again, until refresh() is called.
+class IFOCache {
+  /// A file in the cache
+  class Entry {
+  public:
+    /// Whether the file could be opened at all
+    bool opened;
+
+    /// The size, in sectors
+    int sectors;
+
+    /// The contents
+    std::vector<unsigned char> data;
+
+    /// Whether each sector was read successfully
+    std::vector<bool> good;
+
+    /// Whether each sector failed to read since the last refresh()
+    std::vector<bool> failed;
+  };
+
+  /// The reader
+  dvd_reader_t * reader;
+
+  /// Where the disc reads are recorded, if not NULL
+  ReadStatistics * statistics;
+
+  /// The files, by title and domain
+  std::map<std::pair<int, int>, std::unique_ptr<Entry> > entries;
+
+  /// Returns the entry of the file, loading it if needed.
+  Entry * entry(const DVDFileData * dat);
+
+  /// Reads the sectors from the disc, marking those read as good.
+  /// Returns the number of sectors read at @a offset, or -1 on
+  /// error.
+  int readDisc(DVDFile * file, Entry * e, int offset, int blocks);
+
+  /// Reads the sectors from the disc in one go, and then one by one
+  /// those that couldn't be read, marking those that fail.
+  void fill(DVDFile * file, Entry * e, int offset, int blocks);
+
+public:
+
+  /// Creates a cache for the files of the given reader; disc reads
+  /// are recorded in @a stats if it is not NULL.
+  IFOCache(dvd_reader_t * reader, ReadStatistics * stats);
+
+  /// The size of the file, in sectors, or -1 if it can't be opened.
+  int fileSize(const DVDFileData * dat);
+
+  /// Whether all the sectors of the file could be read.
+  bool complete(const DVDFileData * dat);
+
+  /// Reads sectors from the cache, as DVDFile::readBlocks. Sectors
+  /// missing in the cache are read from the disc, unless they failed
+  /// already.
+  int readBlocks(const DVDFileData * dat, int offset, int blocks,
+                 unsigned char * dest);
+
+  /// Lets the sectors of the file that failed be tried again on the
+  /// disc the next time they are requested, as in a second pass.
+  void refresh(const DVDFileData * dat);
+
+  /// Returns a DVDFile reading from the cache, or NULL if the file
+  /// can't be opened. To be freed with delete.
+  DVDFile * openFile(const DVDFileData * dat);
+};
+
+#endif
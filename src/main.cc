@@ -25,23 +25,84 @@
 #include "headers.hh"
 #include "dvdcopy.hh"
 #include "dvdreader.hh"
+#include "batch.hh"
+#include "driveprofiles.hh"
+#include "multidrive.hh"
+#include "triage.hh"
+#include "retryrouter.hh"
+#include "dvddrive.hh"
+#include "trace.hh"
 
 #include <getopt.h>
 
 void printHelp(const char * progname)
 {
   std::cout << "Usage: " << progname 
-            << " source target\n\n" 
+            << " source target\n"
+            << "       " << progname << " --batch sources target\n"
+            << "       " << progname << " --drives dev1,dev2... target\n"
+            << "       " << progname << " --second-pass --drives dev1,dev2... target\n"
+            << "       " << progname << " --triage source\n\n"
             << "Copies the DVD at the device source to the directory target\n\n"
             << "Options: \n" 
             << " -h, --help: print this help message\n"
             << " -l, --list: list files contained on the DVD\n"
             << " -n, --number NB:  read NB sectors at a time\n"
             << " -s, --second-pass: run a second pass reading only bad sectors\n"
+            << " --give-up NB: the second pass gives up on ranges that failed\n"
+            << "    NB times in a row (3 by default, 0 for never)\n"
+            << " --chapters TITLE[,FIRST[-LAST]]: the second pass only retries\n"
+            << "    the bad sectors within these chapters of the title\n"
+            << " --time-range TITLE,START-END: same, within that time range\n"
+            << "    of the title (in seconds, mm:ss or hh:mm:ss)\n"
             << " -b, --bad-sectors: specify an alternate bad sectors file\n" 
             << " -S, --scan: scan directory for bad sectors\n" 
             << " -I, --ifo-scan: scan ifo files for info\n" 
-            << " -e, --eject: attempts to eject the source after copying\n";
+            << " -e, --eject: attempts to eject the source after copying\n"
+            << " --batch: copies all the images in the directory (or the list\n"
+            << "    file) sources, each into a subdirectory of target\n"
+            << " -j, --jobs NB: in batch mode, run NB copies at the same time;\n"
+            << "    with --second-pass on an image, retry with NB workers\n"
+            << " --io-jobs NB: in batch mode, at most NB reads at the same time\n"
+            << " --drives LIST: copies from all the drives in the comma-separated\n"
+            << "    LIST at the same time, each into a subdirectory of target\n"
+            << " -s --drives LIST: runs the second pass of the copy in target\n"
+            << "    from all the drives at the same time, each range going to a\n"
+            << "    drive that has not failed it yet\n"
+            << " --refill: with --drives, ejects the discs once copied and\n"
+            << "    copies the next ones\n"
+            << " --write-memory MB: with --drives, at most MB megabytes waiting\n"
+            << "    to be written (256 by default)\n"
+            << " --latency-map FILE: writes the latency of every read to FILE\n"
+            << " --heatmap FILE: renders the read latencies as a PPM image\n"
+            << " --events FD: writes progress events as JSON lines to FD\n"
+            << " --events-socket PATH: same, to the UNIX socket at PATH\n"
+            << " --events-interval SECS: minimum delay between progress events\n"
+            << " --report FILE: writes a JSON report of the run to FILE\n"
+            << " --read-log FILE: logs every read attempt to FILE, for readsim\n"
+            << " --catalog FILE: looks up the disc in the catalog FILE, and\n"
+            << "    records it there once copied\n"
+            << " --on-archived POLICY: what to do with discs already in the\n"
+            << "    catalog: skip (the default), merge or copy\n"
+            << " --profiles FILE: unless -n is given, reads as many sectors\n"
+            << "    at a time as calibrated for the drive in FILE, calibrating\n"
+            << "    it first if it isn't there or is due for revalidation\n"
+            << " --recalibrate: with --profiles, calibrates the drive anyway\n"
+            << " --triage: reads a sample of the source to estimate its damage\n"
+            << "    and the copy time; exits with 0 (pristine), 1 (damaged)\n"
+            << "    or 2 (hopeless)\n"
+            << " --triage-time SECS: time budget of --triage (60 by default)\n"
+            << " --no-vobu-skip: on read errors, skip only the sectors that\n"
+            << "    failed, not up to the next VOBU\n"
+            << " --check-packs: lists the VOB sectors read that are not MPEG\n"
+            << "    packs as bad sectors, for the second pass to read again\n"
+            << " --durability POLICY: when the copy is synced to disc, so that\n"
+            << "    it can be resumed after a power loss: none (the default),\n"
+            << "    part, periodic or bad-range\n"
+            << " --sync-interval SECS: with --durability periodic, the delay\n"
+            << "    between two syncs (30 by default)\n"
+            << " --trace FILE: writes a Chrome trace of the hot paths to FILE\n"
+            << "    (requires compiling with -DDVDCOPY_TRACE)\n";
     
 }
 
@@ -56,6 +117,33 @@ static struct option long_options[] = {
   { "ifo-scan", 0, NULL, 'I' },
   { "splice-ifos", 0, NULL, 10 },
   { "splice-ifos-base", 1, NULL, 11 },
+  { "latency-map", 1, NULL, 12 },
+  { "heatmap", 1, NULL, 13 },
+  { "events", 1, NULL, 14 },
+  { "events-socket", 1, NULL, 15 },
+  { "events-interval", 1, NULL, 16 },
+  { "trace", 1, NULL, 17 },
+  { "report", 1, NULL, 18 },
+  { "read-log", 1, NULL, 19 },
+  { "batch", 0, NULL, 20 },
+  { "jobs", 1, NULL, 'j' },
+  { "io-jobs", 1, NULL, 21 },
+  { "drives", 1, NULL, 22 },
+  { "refill", 0, NULL, 23 },
+  { "write-memory", 1, NULL, 24 },
+  { "catalog", 1, NULL, 25 },
+  { "on-archived", 1, NULL, 26 },
+  { "no-vobu-skip", 0, NULL, 27 },
+  { "triage", 0, NULL, 28 },
+  { "triage-time", 1, NULL, 29 },
+  { "give-up", 1, NULL, 30 },
+  { "chapters", 1, NULL, 31 },
+  { "time-range", 1, NULL, 32 },
+  { "profiles", 1, NULL, 33 },
+  { "recalibrate", 0, NULL, 34 },
+  { "check-packs", 0, NULL, 35 },
+  { "durability", 1, NULL, 36 },
+  { "sync-interval", 1, NULL, 37 },
   { NULL, 0, NULL, 0}
 };
 
@@ -69,9 +157,23 @@ int main(int argc, char ** argv)
   int ifoScan = 0;
   int eject = 0;
   int spliceIFOs = 0;
+  int batchMode = 0;
+  BatchCopy batch;
+  MultiDriveCopy multi;
+  RetryRouter router;
+  int multiDrive = 0;
+  int jobs = 0;
+  Triage triage;
+  int triageMode = 0;
+  std::unique_ptr<DiscCatalog> catalog;
+  DiscCatalog::Policy onArchived = DiscCatalog::Skip;
+  std::unique_ptr<DriveProfiles> profiles;
+  int recalibrate = 0;
+  EventStream * events = NULL;
+  double eventsInterval = -1;
 
   do {
-    option = getopt_long(argc, argv, "b:heIl:sSn:",
+    option = getopt_long(argc, argv, "b:heIj:l:sSn:",
                          long_options, NULL);
     
     switch(option) {
@@ -82,6 +184,97 @@ int main(int argc, char ** argv)
     case 11:
       spliceIFOs = atoi(optarg);
       break;
+    case 12:
+      dvd.latencyMapFile = optarg;
+      break;
+    case 13:
+      dvd.heatmapFile = optarg;
+      break;
+    case 14:
+      events = EventStream::toDescriptor(atoi(optarg));
+      dvd.addProgressSink(events);
+      break;
+    case 15:
+      events = EventStream::toSocket(optarg);
+      dvd.addProgressSink(events);
+      break;
+    case 16:
+      eventsInterval = atof(optarg);
+      break;
+    case 17:
+      Trace::setOutput(optarg);
+      break;
+    case 18:
+      dvd.reportFile = optarg;
+      break;
+    case 19:
+      dvd.setReadLog(optarg);
+      break;
+    case 20:
+      batchMode = 1;
+      break;
+    case 21:
+      batch.ioConcurrency = atoi(optarg);
+      break;
+    case 22:
+      multiDrive = 1;
+      multi.addDrives(optarg);
+      router.addDrives(optarg);
+      break;
+    case 23:
+      multi.refill = true;
+      break;
+    case 24: {
+      long mb = atol(optarg);
+      if(mb > 0)
+        multi.writeMemory = mb * 1024 * 1024;
+    }
+      break;
+    case 25:
+      catalog.reset(new DiscCatalog(optarg));
+      break;
+    case 26:
+      onArchived = DiscCatalog::parsePolicy(optarg);
+      break;
+    case 27:
+      dvd.vobuSkip = false;
+      break;
+    case 28:
+      triageMode = 1;
+      break;
+    case 29:
+      triage.budget = atof(optarg);
+      break;
+    case 30:
+      dvd.maxRetryFailures = atoi(optarg);
+      break;
+    case 31:
+      dvd.parts.push_back(TitlePart::chapters(optarg));
+      break;
+    case 32:
+      dvd.parts.push_back(TitlePart::timeRange(optarg));
+      break;
+    case 33:
+      profiles.reset(new DriveProfiles(optarg));
+      break;
+    case 34:
+      recalibrate = 1;
+      break;
+    case 35:
+      dvd.checkPacks = true;
+      break;
+    case 36:
+      dvd.durability = SyncThread::parsePolicy(optarg);
+      break;
+    case 37:
+      dvd.syncInterval = atof(optarg);
+      break;
+    case 'j': {
+      int nb = atoi(optarg);
+      if(nb > 0)
+        batch.concurrency = jobs = nb;
+    }
+      break;
     case 'h': 
       printHelp(argv[0]);
       return 0;
@@ -114,12 +307,57 @@ int main(int argc, char ** argv)
       break;
     }
   } while(option != -1);
-  if(argc != optind + (ifoScan ? 1 : 2)) {
+  if(events && eventsInterval >= 0)
+    events->setInterval(eventsInterval);
+  if(argc != optind + (ifoScan || multiDrive || triageMode ? 1 : 2)) {
     printHelp(argv[0]);
     return 1;
   }
   
-  if(secondPass)
+  if(catalog) {
+    dvd.setCatalog(catalog.get(), onArchived);
+    batch.catalog = multi.catalog = catalog.get();
+    batch.onArchived = multi.onArchived = onArchived;
+  }
+  if(profiles) {
+    dvd.setDriveProfiles(profiles.get(), recalibrate);
+    multi.profiles = profiles.get();
+    multi.recalibrate = recalibrate;
+  }
+
+  if(triageMode) {
+    triage.reportFile = dvd.reportFile;
+    return triage.run(argv[optind]);
+  }
+  else if(multiDrive && secondPass) {
+    router.run(dvd, argv[optind]);
+    return 0;
+  }
+  else if(multiDrive) {
+    multi.sectorsRead = dvd.sectorsRead;
+    multi.vobuSkip = dvd.vobuSkip;
+    multi.checkPacks = dvd.checkPacks;
+    multi.durability = dvd.durability;
+    multi.syncInterval = dvd.syncInterval;
+    multi.reportFile = dvd.reportFile;
+    multi.eject = eject;
+    return multi.run(argv[optind]) ? 1 : 0;
+  }
+  else if(batchMode) {
+    batch.sectorsRead = dvd.sectorsRead;
+    batch.vobuSkip = dvd.vobuSkip;
+    batch.checkPacks = dvd.checkPacks;
+    batch.durability = dvd.durability;
+    batch.syncInterval = dvd.syncInterval;
+    batch.reportFile = dvd.reportFile;
+    batch.addSources(argv[optind], argv[optind+1]);
+    return batch.run() ? 1 : 0;
+  }
+  else if(secondPass && jobs > 1 && ! DVDDrive::isDrive(argv[optind])) {
+    router.addWorkers(argv[optind], jobs);
+    router.run(dvd, argv[optind+1]);
+  }
+  else if(secondPass)
     dvd.secondPass(argv[optind], argv[optind+1]);
   else if(scan)
     dvd.scanForBadSectors(argv[optind], argv[optind+1]);
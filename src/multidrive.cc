@@ -0,0 +1,308 @@
+/**
+    \file multidrive.cc
+    Implementation of the MultiDriveCopy class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "multidrive.hh"
+#include "dvdcopy.hh"
+#include "dvddrive.hh"
+#include "writerpool.hh"
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>
+
+/// Forwards the progress of the copy of one drive to the
+/// MultiDriveCopy
+class DriveProgress : public ProgressSink {
+  MultiDriveCopy * multi;
+  DriveState * drive;
+
+  void update(const ProgressState & state) {
+    std::lock_guard<std::mutex> lock(multi->mutex);
+    drive->runDone = state.runDone;
+    drive->runSectors = state.runSectors;
+    multi->displayProgress();
+  };
+
+public:
+  DriveProgress(MultiDriveCopy * m, DriveState * d) : multi(m), drive(d) {;};
+
+  virtual void fileStarted(const ProgressState & state) {
+    update(state);
+  };
+
+  virtual void progress(const ProgressState & state) {
+    update(state);
+  };
+};
+
+/// Returns the last component of the path
+static std::string baseName(const std::string & path)
+{
+  size_t idx = path.rfind('/');
+  if(idx == std::string::npos)
+    return path;
+  return path.substr(idx + 1);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+MultiDriveCopy::MultiDriveCopy() :
+  lastDisplay(0), startTime(0), refill(false), refillTimeout(600),
+  eject(false), writeMemory(256*1024*1024), sectorsRead(-1), vobuSkip(true),
+  checkPacks(false), durability(SyncThread::None), syncInterval(30),
+  catalog(NULL), onArchived(DiscCatalog::Skip), profiles(NULL),
+  recalibrate(false)
+{
+}
+
+void MultiDriveCopy::addDrives(const char * list)
+{
+  std::string str = list;
+  size_t start = 0;
+  while(start <= str.size()) {
+    size_t end = str.find(',', start);
+    if(end == std::string::npos)
+      end = str.size();
+    if(end > start)
+      drives.push_back(std::unique_ptr<DriveState>
+                       (new DriveState(str.substr(start, end - start))));
+    start = end + 1;
+  }
+}
+
+void MultiDriveCopy::displayProgress()
+{
+  long now = ReadStatistics::timestamp();
+  if(now - lastDisplay < 1000000)
+    return;
+  lastDisplay = now;
+
+  std::string line;
+  for(int i = 0; i < drives.size(); i++) {
+    const DriveState * d = drives[i].get();
+    char buffer[100];
+    if(d->runSectors > 0)
+      snprintf(buffer, sizeof(buffer), " %s: %3d%%",
+               baseName(d->device).c_str(),
+               (int) (d->runDone * 100 / d->runSectors));
+    else
+      snprintf(buffer, sizeof(buffer), " %s: idle",
+               baseName(d->device).c_str());
+    line += buffer;
+  }
+  printf("\r%s     ", line.c_str());
+  fflush(stdout);
+}
+
+void MultiDriveCopy::copyDisc(DriveState * drive, WriterPool * pool,
+                              const char * target)
+{
+  // Each disc goes to a new directory. It is looked for and created
+  // with the mutex held, so that two drives with the same name don't
+  // pick the same one.
+  std::string name = baseName(drive->device);
+  std::string dest;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(int i = 1; ; i++) {
+      char buffer[20];
+      snprintf(buffer, sizeof(buffer), "-%03d", i);
+      dest = std::string(target) + "/" + name + buffer;
+      // Other failures show up when the copy sets up its target
+      if(mkdir(dest.c_str(), 0755) == 0 || errno != EEXIST)
+        break;
+    }
+    drive->target = dest;
+    drive->runDone = 0;
+    drive->runSectors = 0;
+    printf("\nCopying %s to %s\n", drive->device.c_str(), dest.c_str());
+  }
+
+  long start = ReadStatistics::timestamp();
+  DVDCopy dvd(false);
+  dvd.sectorsRead = sectorsRead;
+  dvd.vobuSkip = vobuSkip;
+  dvd.checkPacks = checkPacks;
+  dvd.durability = durability;
+  dvd.syncInterval = syncInterval;
+  dvd.setWriterPool(pool, drive->channel);
+  if(catalog)
+    dvd.setCatalog(catalog, onArchived);
+  if(profiles)
+    dvd.setDriveProfiles(profiles, recalibrate);
+  dvd.addProgressSink(new DriveProgress(this, drive));
+
+  std::string error;
+  try {
+    dvd.copy(drive->device.c_str(), dest.c_str());
+  }
+  catch(const std::exception & e) {
+    error = e.what();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  drive->statistics.merge(dvd.readStatistics());
+  drive->discs += 1;
+  drive->copyTime += ReadStatistics::timestamp() - start;
+  drive->sectors += drive->runDone;
+  drive->badSectors += dvd.badSectorCount();
+  if(error.empty() && onArchived == DiscCatalog::Skip &&
+     ! dvd.archivedCopy().empty())
+    printf("\nSkipped the disc in %s: already archived in %s\n",
+           drive->device.c_str(), dvd.archivedCopy().c_str());
+  else if(error.empty())
+    printf("\nFinished copying %s to %s: %ld bad sectors\n",
+           drive->device.c_str(), dest.c_str(), dvd.badSectorCount());
+  else {
+    drive->failures += 1;
+    drive->error = error;
+    printf("\nFailed copying %s: %s\n", drive->device.c_str(),
+           error.c_str());
+  }
+  drive->runDone = 0;
+  drive->runSectors = 0;
+
+  // Don't leave an empty directory behind if the disc was skipped
+  if(! dvd.archivedCopy().empty())
+    rmdir(dest.c_str());
+}
+
+void MultiDriveCopy::driveLoop(DriveState * drive, WriterPool * pool,
+                               const char * target)
+{
+  drive->statistics.setPhase("copy");
+  bool isDrive = DVDDrive::isDrive(drive->device.c_str());
+  while(true) {
+    copyDisc(drive, pool, target);
+    if(! isDrive)
+      break;
+    if(refill || eject)
+      DVDDrive::eject(drive->device.c_str());
+    if(! refill)
+      break;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      printf("\nWaiting for a new disc in %s\n", drive->device.c_str());
+    }
+    if(! DVDDrive::waitForMedia(drive->device.c_str(), refillTimeout)) {
+      std::lock_guard<std::mutex> lock(mutex);
+      printf("\nNo new disc in %s, done with that drive\n",
+             drive->device.c_str());
+      break;
+    }
+  }
+}
+
+int MultiDriveCopy::run(const char * target)
+{
+  struct stat st;
+  if(stat(target, &st)) {
+    fprintf(stderr, "Creating directory %s\n", target);
+    mkdir(target, 0755);
+  }
+
+  printf("Copying from %d drives, with at most %.0f MB waiting to be written\n",
+         (int) drives.size(), writeMemory/1048576.);
+  startTime = ReadStatistics::timestamp();
+
+  int failures = 0;
+  {
+    WriterPool pool(writeMemory);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < drives.size(); i++) {
+      drives[i]->channel = pool.addChannel(drives[i]->device);
+      threads.push_back(std::thread(&MultiDriveCopy::driveLoop, this,
+                                    drives[i].get(), &pool, target));
+    }
+    for(int i = 0; i < threads.size(); i++)
+      threads[i].join();
+
+    displayReport();
+    if(! reportFile.empty()) {
+      printf("Writing multi-drive report to '%s'\n", reportFile.c_str());
+      writeJSONReport(reportFile.c_str());
+    }
+  }
+
+  for(int i = 0; i < drives.size(); i++) {
+    failures += drives[i]->failures;
+    drives[i]->channel = NULL;
+  }
+  return failures;
+}
+
+void MultiDriveCopy::displayReport()
+{
+  printf("\nDrives report:\n");
+  ReadStatistics all;
+  all.setPhase("copy");
+  for(int i = 0; i < drives.size(); i++) {
+    DriveState * d = drives[i].get();
+    const PhaseStatistics & ph = d->statistics.phases.back();
+    printf(" %s: %d discs (%d failed), %ld sectors, %ld bad, in %.1fs\n",
+           d->device.c_str(), d->discs, d->failures, d->sectors,
+           d->badSectors, d->copyTime * 1e-6);
+    printf("   reads: %ld calls, %.1fs (%.1f MB/s), %ld failed (%.1fs)\n",
+           ph.reads, ph.readTime * 1e-6,
+           ph.readTime > 0 ? ph.sectorsRead * 2048. / ph.readTime : 0,
+           ph.failedReads, ph.failedReadTime * 1e-6);
+    const WriterChannel * c = d->channel;
+    printf("   writes: %ld calls, %.1f MB, %.1fs (%.1f MB/s), "
+           "%.1fs waiting for the writer\n",
+           c->writes, c->bytes * 1e-6, c->writeTime * 1e-6,
+           c->writeTime > 0 ? c->bytes * 1.0 / c->writeTime : 0,
+           c->waitTime * 1e-6);
+    all.merge(d->statistics);
+  }
+  all.phaseStart = startTime;
+  all.displayHistograms();
+  all.displayReport();
+}
+
+void MultiDriveCopy::writeJSONReport(const char * fileName)
+{
+  FILE * out = fopen(fileName, "w");
+  if(! out) {
+    std::string err = "Could not open report file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "{\n\"drives\": [");
+  for(int i = 0; i < drives.size(); i++) {
+    DriveState * d = drives[i].get();
+    const WriterChannel * c = d->channel;
+    fprintf(out, "%s\n  {\"device\": %s, \"discs\": %d, \"failures\": %d, "
+            "\"sectors\": %ld, \"bad_sectors\": %ld, \"copy_us\": %ld, "
+            "\"writes\": %ld, \"bytes_written\": %ld, \"write_us\": %ld, "
+            "\"write_wait_us\": %ld,\n   \"statistics\": ",
+            i ? "," : "", EventStream::quote(d->device).c_str(),
+            d->discs, d->failures, d->sectors, d->badSectors, d->copyTime,
+            c->writes, c->bytes, c->writeTime, c->waitTime);
+    d->statistics.writeJSON(out);
+    fprintf(out, "  }");
+  }
+  fprintf(out, "\n]\n}\n");
+  fclose(out);
+}
@@ -0,0 +1,159 @@
+/**
+    \file multidrive.hh
+    The MultiDriveCopy class, to copy from several drives at once
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __MULTIDRIVE_H
+#define __MULTIDRIVE_H
+
+#include "readstats.hh"
+#include "catalog.hh"
+#include "syncthread.hh"
+
+#include <mutex>
+
+class WriterPool;
+class WriterChannel;
+class DriveProfiles;
+
+/// The state and the metrics of one drive
+class DriveState {
+public:
+  /// The device
+  std::string device;
+
+  /// The channel through which the copies of this drive are written
+  WriterChannel * channel;
+
+  /// The number of discs copied, and of those that failed
+  int discs, failures;
+
+  /// The last error
+  std::string error;
+
+  /// The number of sectors processed, and how many of them are bad
+  long sectors, badSectors;
+
+  /// The time spent copying, in microseconds
+  long copyTime;
+
+  /// The statistics of all the discs read in this drive
+  ReadStatistics statistics;
+
+  /// The target of the current copy
+  std::string target;
+
+  /// The progress of the current copy
+  long runDone, runSectors;
+
+  DriveState(const std::string & dev) :
+    device(dev), channel(NULL), discs(0), failures(0), sectors(0),
+    badSectors(0), copyTime(0), runDone(0), runSectors(0) {;};
+};
+
+/// Copies from several drives at the same time, each in its own
+/// thread, all the output going through a single WriterPool.
+///
+/// Each copy goes to its own subdirectory of the target, named after
+/// the drive and numbered. In refill mode, drives are ejected after
+/// each copy, and the next disc inserted is copied in turn.
+class MultiDriveCopy {
+  /// The drives
+  std::vector<std::unique_ptr<DriveState> > drives;
+
+  /// Protects the terminal and the progress of the drives
+  std::mutex mutex;
+
+  /// The last time the progress line was updated, in microseconds
+  long lastDisplay;
+
+  /// The time at which the copy started, in microseconds
+  long startTime;
+
+  /// Copies discs from the given drive until done.
+  void driveLoop(DriveState * drive, WriterPool * pool, const char * target);
+
+  /// Copies the disc in the given drive.
+  void copyDisc(DriveState * drive, WriterPool * pool, const char * target);
+
+  /// Displays the progress line. Must be called with the mutex held.
+  void displayProgress();
+
+  friend class DriveProgress;
+
+public:
+
+  MultiDriveCopy();
+
+  /// Adds drives, given as a comma-separated list of devices.
+  void addDrives(const char * list);
+
+  /// Copies from all the drives into subdirectories of @a
+  /// target. Returns the number of copies that failed.
+  int run(const char * target);
+
+  /// Displays the metrics of each drive, including its writes. Must
+  /// be called while the writer pool is still alive.
+  void displayReport();
+
+  /// Writes the same as displayReport in JSON format.
+  void writeJSONReport(const char * file);
+
+  /// Whether to eject the discs when they are copied, and wait for
+  /// the next one.
+  bool refill;
+
+  /// How long to wait for a new disc in refill mode, in seconds
+  double refillTimeout;
+
+  /// Whether to eject the discs after copying (always done in refill
+  /// mode)
+  bool eject;
+
+  /// The maximum amount of data waiting to be written, in bytes
+  size_t writeMemory;
+
+  /// Number of sectors read in one go
+  int sectorsRead;
+
+  /// Whether read errors skip to the next VOBU
+  bool vobuSkip;
+
+  /// Whether the copies check that the VOB sectors are MPEG packs
+  bool checkPacks;
+
+  /// The durability policy of the copies, and the interval of the
+  /// periodic one (see SyncThread)
+  SyncThread::Policy durability;
+  double syncInterval;
+
+  /// If not empty, the file in which the report is written in JSON
+  /// format
+  std::string reportFile;
+
+  /// If not NULL, the catalog of the archived discs, and what to do
+  /// with those found in there
+  DiscCatalog * catalog;
+  DiscCatalog::Policy onArchived;
+
+  /// If not NULL, the read sizes calibrated for the drives, and
+  /// whether to calibrate them again anyway
+  DriveProfiles * profiles;
+  bool recalibrate;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/**
+    \file outputfiles.cc
+    Implementation of the OutputFiles class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "outputfiles.hh"
+#include "dvdreader.hh"
+#include "writerpool.hh"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+OutputFiles::OutputFiles(const std::string & t) : target(t)
+{
+}
+
+int OutputFiles::fd(int title, dvd_read_domain_t domain, int part)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::array<int, 3> key = {{ title, (int) domain, part }};
+  std::map<std::array<int, 3>, int>::iterator i = fds.find(key);
+  if(i != fds.end())
+    return i->second;
+  std::string name = target + "/VIDEO_TS/" +
+    DVDFileData::fileName(title, domain, part);
+  int f = open(name.c_str(), O_CREAT|O_WRONLY, 0666);
+  if(f < 0) {
+    std::string err("Failed to open output file '");
+    err += name + "': " + strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fds[key] = f;
+  return f;
+}
+
+void OutputFiles::writeSectors(int title, dvd_read_domain_t domain,
+                               int sector, const char * data, size_t number,
+                               WriterPool * pool, WriterChannel * channel)
+{
+  while(number > 0) {
+    int part = 0;
+    int offset = sector;
+    size_t nb = number;
+    if(domain == DVD_READ_TITLE_VOBS) {
+      part = sector / partSectors + 1;
+      offset = sector % partSectors;
+      if(offset + nb > partSectors)
+        nb = partSectors - offset;
+    }
+    int f = fd(title, domain, part);
+    size_t done = 0;
+    if(pool) {
+      pool->write(channel, f, (off_t) offset * 2048, data, nb * 2048);
+      done = nb * 2048;
+    }
+    while(done < nb * 2048) {
+      ssize_t wr = pwrite(f, data + done, nb * 2048 - done,
+                          (off_t) offset * 2048 + done);
+      if(wr < 0) {
+        if(errno == EINTR)
+          continue;
+        std::string err("Write error: ");
+        err += strerror(errno);
+        throw std::runtime_error(err);
+      }
+      done += wr;
+    }
+    data += nb * 2048;
+    sector += nb;
+    number -= nb;
+  }
+}
+
+OutputFiles::~OutputFiles()
+{
+  for(std::map<std::array<int, 3>, int>::iterator i = fds.begin();
+      i != fds.end(); i++)
+    close(i->second);
+}
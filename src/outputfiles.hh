@@ -0,0 +1,63 @@
+/**
+    \file outputfiles.hh
+    The OutputFiles class, output files shared between threads
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __OUTPUTFILES_H
+#define __OUTPUTFILES_H
+
+#include <mutex>
+
+class WriterPool;
+class WriterChannel;
+
+/// The output files of a copy, opened once and possibly shared by
+/// all the threads writing to the copy. Writes are positional, so that
+/// threads can write anywhere in any file without seeking, and
+/// without reopening the files for each range.
+class OutputFiles {
+  /// The target directory
+  std::string target;
+
+  /// The file descriptors, by title, domain and part number
+  std::map<std::array<int, 3>, int> fds;
+
+  /// Protects the file descriptors
+  std::mutex mutex;
+
+public:
+
+  /// The size of the parts of title VOBs, in sectors (1GB)
+  static const int partSectors = 512*1024;
+
+  OutputFiles(const std::string & target);
+
+  /// Returns the file descriptor of the given part (0 for all but the
+  /// title VOBs), opening it if needed.
+  int fd(int title, dvd_read_domain_t domain, int part);
+
+  /// Writes @a number sectors at @a sector in the file, handling the
+  /// boundaries between the parts of title VOBs. If @a pool isn't
+  /// NULL, the data is queued there on @a channel instead.
+  void writeSectors(int title, dvd_read_domain_t domain, int sector,
+                    const char * data, size_t number,
+                    WriterPool * pool = NULL, WriterChannel * channel = NULL);
+
+  ~OutputFiles();
+};
+
+#endif
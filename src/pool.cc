@@ -0,0 +1,107 @@
+/**
+    \file pool.cc
+    Implementation of the BufferPool and IOSlots classes
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "pool.hh"
+#include "readstats.hh"
+
+BufferPool::BufferPool(int buffers, int s) :
+  sectors(s), maxBuffers(buffers), allocated(0)
+{
+  if(maxBuffers < 1)
+    maxBuffers = 1;
+}
+
+unsigned char * BufferPool::acquire()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(available.empty() && allocated >= maxBuffers)
+    released.wait(lock);
+  if(! available.empty()) {
+    unsigned char * buf = available.back();
+    available.pop_back();
+    return buf;
+  }
+  ++allocated;
+  return new unsigned char[sectors * 2048];
+}
+
+void BufferPool::release(unsigned char * buffer)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    available.push_back(buffer);
+  }
+  released.notify_one();
+}
+
+BufferPool::~BufferPool()
+{
+  for(int i = 0; i < available.size(); i++)
+    delete[] available[i];
+}
+
+BufferPool::Buffer::Buffer(BufferPool * p, int s) : pool(p)
+{
+  if(pool && s <= pool->bufferSectors())
+    data = pool->acquire();
+  else {
+    pool = NULL;
+    data = new unsigned char[s * 2048];
+  }
+}
+
+BufferPool::Buffer::~Buffer()
+{
+  if(pool)
+    pool->release(data);
+  else
+    delete[] data;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+IOSlots::IOSlots(int slots) : free(slots), waitTime(0)
+{
+  if(free < 1)
+    free = 1;
+}
+
+void IOSlots::acquire()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  if(free > 0) {
+    --free;
+    return;
+  }
+  long before = ReadStatistics::timestamp();
+  while(free <= 0)
+    released.wait(lock);
+  --free;
+  waitTime += ReadStatistics::timestamp() - before;
+}
+
+void IOSlots::release()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++free;
+  }
+  released.notify_one();
+}
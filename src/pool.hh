@@ -0,0 +1,123 @@
+/**
+    \file pool.hh
+    Resources shared between concurrent copies: read buffers and I/O slots
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/// A pool of read buffers of a fixed size, shared by several
+/// copies. Buffers are allocated on demand, up to a maximum number,
+/// and recycled afterwards, so that the memory used by the reads
+/// stays bounded whatever the number of copies.
+class BufferPool {
+  /// The size of each buffer, in sectors
+  int sectors;
+
+  /// The maximum number of buffers
+  int maxBuffers;
+
+  /// The number of buffers allocated so far
+  int allocated;
+
+  /// The buffers not in use
+  std::vector<unsigned char *> available;
+
+  std::mutex mutex;
+  std::condition_variable released;
+
+public:
+
+  /// Creates a pool of at most @a buffers buffers of @a sectors
+  /// sectors each.
+  BufferPool(int buffers, int sectors);
+
+  /// The size of the buffers, in sectors
+  int bufferSectors() const { return sectors; };
+
+  /// Returns a buffer, waiting for one to be released if all of them
+  /// are in use.
+  unsigned char * acquire();
+
+  /// Gives back a buffer obtained with acquire()
+  void release(unsigned char * buffer);
+
+  ~BufferPool();
+
+  /// A buffer of the given size, taken from the pool if possible
+  /// (the pool may be NULL) or allocated otherwise, and given back
+  /// at destruction.
+  class Buffer {
+    BufferPool * pool;
+    unsigned char * data;
+
+    Buffer(const Buffer &);
+    Buffer & operator=(const Buffer &);
+  public:
+    Buffer(BufferPool * pool, int sectors);
+    ~Buffer();
+
+    unsigned char * get() const { return data; };
+  };
+};
+
+/// Limits the number of reads running at the same time.
+class IOSlots {
+  /// The number of free slots
+  int free;
+
+  std::mutex mutex;
+  std::condition_variable released;
+
+  /// The total time spent waiting for a slot, in microseconds
+  std::atomic<long> waitTime;
+
+public:
+
+  /// Allows at most @a slots concurrent reads.
+  IOSlots(int slots);
+
+  /// Waits for a free slot and takes it.
+  void acquire();
+
+  /// Releases a slot taken with acquire().
+  void release();
+
+  /// Returns the total time spent waiting for a slot, in
+  /// microseconds.
+  long totalWaitTime() const { return waitTime; };
+
+  /// Takes a slot for the lifetime of the object.
+  class Slot {
+    IOSlots * slots;
+  public:
+    Slot(IOSlots * s) : slots(s) {
+      if(slots)
+        slots->acquire();
+    };
+    ~Slot() {
+      if(slots)
+        slots->release();
+    };
+  };
+};
+
+#endif
@@ -0,0 +1,498 @@
+/**
+    \file progress.cc
+    Implementation of the Progress class and the progress sinks
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "progress.hh"
+#include "dvdreader.hh"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+void TerminalProgress::fileStarted(const ProgressState & state)
+{
+  printf("\nReading %d sectors at a time\n", state.steps);
+}
+
+void TerminalProgress::reading(const ProgressState & state)
+{
+  std::string fileName = state.file->fileName(true, state.sector);
+  printf("\rReading block %7d/%d (%s)",
+         state.sector, state.fileSectors, fileName.c_str());
+}
+
+void TerminalProgress::readError(const ProgressState & state,
+                                 int sector, int nb)
+{
+  std::string fileName = state.file->fileName(true, sector);
+  printf("\nError while reading block %d of file %s, skipping\n",
+         sector, fileName.c_str());
+}
+
+/// Formats a duration in seconds as [h:]mm:ss
+static std::string formatDuration(double seconds)
+{
+  char buffer[30];
+  int s = (int) seconds;
+  if(s >= 3600)
+    snprintf(buffer, sizeof(buffer), "%d:%02d:%02d",
+             s / 3600, (s / 60) % 60, s % 60);
+  else
+    snprintf(buffer, sizeof(buffer), "%02d:%02d", s / 60, s % 60);
+  return std::string(buffer);
+}
+
+void TerminalProgress::progress(const ProgressState & state)
+{
+  double rate = (state.windowRate > 0 ? state.windowRate : state.rate);
+  const char * rate_suffix;
+  if(rate >= 1e6) {
+    rate_suffix = "MB/s";
+    rate /= 1e6;
+  }
+  else if(rate >= 1e3) {
+    rate_suffix = "kB/s";
+    rate /= 1e3;
+  }
+  else
+    rate_suffix = "B/s";
+  if(state.runSectors > 0) {
+    std::string remaining = (state.runRemaining >= 0 ?
+                             formatDuration(state.runRemaining) : "--:--");
+    printf(" (%3d%%, %s, %s left, %5.1f%s)",
+           (int) (100 * state.runDone / state.runSectors),
+           formatDuration(state.runElapsed).c_str(), remaining.c_str(),
+           rate, rate_suffix);
+  }
+  else
+    printf(" (%02d:%02d out of %02d:%02d, %5.1f%s)",
+           ((int) state.elapsed) / 60, ((int) state.elapsed) % 60,
+           ((int) state.estimated) / 60, ((int) state.estimated) % 60,
+           rate, rate_suffix);
+  fflush(stdout);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+EventStream::EventStream(int f, bool o, bool s) :
+  fd(f), owned(o), isSocket(s), interval(0.5), lastProgress(-1)
+{
+  // We'd rather lose the stream than die because the controller went
+  // away.
+  signal(SIGPIPE, SIG_IGN);
+}
+
+EventStream * EventStream::toDescriptor(int fd)
+{
+  return new EventStream(fd, false, false);
+}
+
+EventStream * EventStream::toSocket(const char * path)
+{
+  struct sockaddr_un addr;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    std::string err = "Socket path too long: ";
+    err += path;
+    throw std::runtime_error(err);
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) {
+    std::string err = "Could not create socket: ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    std::string err = "Could not connect to socket '";
+    err += path;
+    err += "': ";
+    err += strerror(errno);
+    close(fd);
+    throw std::runtime_error(err);
+  }
+  return new EventStream(fd, true, true);
+}
+
+EventStream::~EventStream()
+{
+  if(owned && fd >= 0)
+    close(fd);
+}
+
+std::string EventStream::quote(const std::string & str)
+{
+  std::string ret("\"");
+  for(int i = 0; i < str.size(); i++) {
+    unsigned char c = str[i];
+    if(c == '"' || c == '\\') {
+      ret += '\\';
+      ret += c;
+    }
+    else if(c < 0x20) {
+      char buf[10];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    }
+    else
+      ret += c;
+  }
+  ret += '"';
+  return ret;
+}
+
+void EventStream::emit(const std::string & line)
+{
+  if(fd < 0)
+    return;
+  std::string l = line + "}\n";
+  const char * data = l.c_str();
+  size_t left = l.size();
+  while(left > 0) {
+    ssize_t nb;
+    if(isSocket)
+      nb = send(fd, data, left, MSG_NOSIGNAL);
+    else
+      nb = write(fd, data, left);
+    if(nb < 0) {
+      if(errno == EINTR)
+        continue;
+      // The other side is gone, no need to insist
+      fprintf(stderr, "\nError writing events, disabling: %s\n",
+              strerror(errno));
+      if(owned)
+        close(fd);
+      fd = -1;
+      return;
+    }
+    data += nb;
+    left -= nb;
+  }
+}
+
+std::string EventStream::startEvent(const char * name,
+                                    const ProgressState & state)
+{
+  char buffer[200];
+  snprintf(buffer, sizeof(buffer),
+           "{\"event\":\"%s\",\"time\":%.3f,\"phase\":",
+           name, Progress::now());
+  std::string ret(buffer);
+  ret += quote(state.phase);
+  if(state.file) {
+    ret += ",\"file\":";
+    ret += quote(state.file->fileName(true, state.sector));
+    snprintf(buffer, sizeof(buffer),
+             ",\"title\":%d,\"domain\":%d,\"sector\":%d,\"sectors\":%d",
+             state.file->title, state.file->domain,
+             state.sector, state.fileSectors);
+    ret += buffer;
+  }
+  snprintf(buffer, sizeof(buffer), ",\"errors\":%d,\"skipped\":%d",
+           state.errors, state.skipped);
+  ret += buffer;
+  return ret;
+}
+
+void EventStream::phaseChanged(const ProgressState & state,
+                               const std::string & detail)
+{
+  std::string ev = startEvent("phase", state);
+  if(! detail.empty())
+    ev += ",\"detail\":" + quote(detail);
+  emit(ev);
+}
+
+void EventStream::fileStarted(const ProgressState & state)
+{
+  char buffer[100];
+  std::string ev = startEvent("file-start", state);
+  snprintf(buffer, sizeof(buffer), ",\"first\":%d,\"steps\":%d",
+           state.firstSector, state.steps);
+  emit(ev + buffer);
+  lastProgress = -1;
+}
+
+void EventStream::progress(const ProgressState & state)
+{
+  double t = Progress::now();
+  if(lastProgress >= 0 && t - lastProgress < interval)
+    return;
+  lastProgress = t;
+  char buffer[200];
+  std::string ev = startEvent("progress", state);
+  snprintf(buffer, sizeof(buffer),
+           ",\"elapsed\":%.3f,\"eta\":%.3f,\"rate\":%.0f",
+           state.elapsed, state.estimated - state.elapsed, state.rate);
+  ev += buffer;
+  snprintf(buffer, sizeof(buffer),
+           ",\"run_sectors\":%ld,\"run_done\":%ld,\"run_elapsed\":%.3f,"
+           "\"run_eta\":%.3f,\"window_rate\":%.0f,"
+           "\"read_time\":%.3f,\"error_time\":%.3f",
+           state.runSectors, state.runDone, state.runElapsed,
+           state.runRemaining, state.windowRate,
+           state.readTime, state.errorTime);
+  emit(ev + buffer);
+}
+
+void EventStream::readError(const ProgressState & state, int sector, int nb)
+{
+  char buffer[100];
+  std::string ev = startEvent("read-error", state);
+  snprintf(buffer, sizeof(buffer), ",\"at\":%d,\"number\":%d",
+           sector, nb);
+  emit(ev + buffer);
+}
+
+void EventStream::fileFinished(const ProgressState & state)
+{
+  char buffer[100];
+  std::string ev = startEvent("file-end", state);
+  snprintf(buffer, sizeof(buffer), ",\"elapsed\":%.3f,\"rate\":%.0f",
+           state.elapsed, state.rate);
+  emit(ev + buffer);
+}
+
+void EventStream::note(const ProgressState & state, const char * what,
+                       const std::string & detail)
+{
+  std::string ev = startEvent(what, state);
+  if(! detail.empty())
+    ev += ",\"detail\":" + quote(detail);
+  emit(ev);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+Progress::Progress() : sector(0), runDone(0), readTime(0), errorTime(0),
+                       renderedSector(-1), renderedDone(-1),
+                       stopping(false), refresh(0.2),
+                       fileStart(0), runStart(now()), readStart(0),
+                       readFailed(false), window(60)
+{
+}
+
+Progress::~Progress()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  if(renderer.joinable())
+    renderer.join();
+  for(int i = 0; i < sinks.size(); i++)
+    delete sinks[i];
+}
+
+double Progress::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+void Progress::addSink(ProgressSink * sink)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  sinks.push_back(sink);
+}
+
+void Progress::snapshot()
+{
+  state.sector = sector.load();
+  state.runDone = runDone.load();
+  state.readTime = readTime.load();
+  state.errorTime = errorTime.load();
+}
+
+ProgressState Progress::current() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  ProgressState ret = state;
+  ret.sector = sector.load();
+  ret.runDone = runDone.load();
+  ret.readTime = readTime.load();
+  ret.errorTime = errorTime.load();
+  return ret;
+}
+
+void Progress::renderLoop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(! stopping) {
+    wake.wait_for(lock, std::chrono::duration<double>(refresh));
+    if(! stopping && state.file)
+      render();
+  }
+}
+
+void Progress::render()
+{
+  snapshot();
+  if(state.sector == renderedSector && state.runDone == renderedDone)
+    return;
+  renderedSector = state.sector;
+  renderedDone = state.runDone;
+
+  // The rate over the window: we always keep at least one sample
+  // older than the window, so that the rate is computed over at
+  // least the window duration.
+  double t = now();
+  samples.push_back(std::make_pair(t, state.runDone));
+  while(samples.size() > 2 && t - samples[1].first > window)
+    samples.pop_front();
+  if(samples.size() > 1 && t > samples.front().first) {
+    state.windowRate = (samples.back().second - samples.front().second) *
+      2048. / (t - samples.front().first);
+    long left = state.runSectors - state.runDone;
+    if(left < 0)
+      left = 0;
+    if(state.windowRate > 0)
+      state.runRemaining = left * 2048. / state.windowRate;
+  }
+
+  updateTiming();
+  for(int i = 0; i < sinks.size(); i++) {
+    sinks[i]->reading(state);
+    sinks[i]->progress(state);
+  }
+}
+
+void Progress::setPhase(const char * phase, const std::string & detail)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot();
+  state.phase = phase;
+  state.file = NULL;
+  for(int i = 0; i < sinks.size(); i++)
+    sinks[i]->phaseChanged(state, detail);
+}
+
+void Progress::startFile(const DVDFileData * dat, int start, int end,
+                         int total, int steps)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  sector = start;
+  snapshot();
+  state.file = dat;
+  state.firstSector = start;
+  state.endSector = end;
+  state.fileSectors = total;
+  state.steps = steps;
+  state.elapsed = 0;
+  state.estimated = 0;
+  state.rate = 0;
+  renderedSector = -1;
+  fileStart = now();
+  for(int i = 0; i < sinks.size(); i++)
+    sinks[i]->fileStarted(state);
+  if(! renderer.joinable() && ! sinks.empty())
+    renderer = std::thread(&Progress::renderLoop, this);
+}
+
+void Progress::startRun(long sectors)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  runStart = now();
+  state.runSectors = sectors;
+  runDone = 0;
+  state.runElapsed = 0;
+  state.runRemaining = -1;
+  state.windowRate = 0;
+  readTime = 0;
+  errorTime = 0;
+  samples.clear();
+}
+
+void Progress::alreadyDone(long sectors)
+{
+  runDone += sectors;
+}
+
+void Progress::reading(int s)
+{
+  sector.store(s, std::memory_order_relaxed);
+  readStart = now();
+  readFailed = false;
+}
+
+void Progress::updateTiming()
+{
+  int done = state.sector - state.firstSector;
+  double t = now();
+  state.elapsed = t - fileStart;
+  state.runElapsed = t - runStart;
+  if(done > 0 && state.elapsed > 0) {
+    state.estimated = (state.elapsed *
+                       (state.endSector - state.firstSector)) / done;
+    state.rate = (done * 2048.)/(state.elapsed);
+  }
+}
+
+void Progress::advance(int s)
+{
+  // Only this thread writes these, so there is no need for atomic
+  // increments.
+  std::atomic<double> & time = (readFailed ? errorTime : readTime);
+  time.store(time.load(std::memory_order_relaxed) + now() - readStart,
+             std::memory_order_relaxed);
+  runDone.store(runDone.load(std::memory_order_relaxed) +
+                s - sector.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+  sector.store(s, std::memory_order_relaxed);
+}
+
+void Progress::readError(int s, int nb)
+{
+  readFailed = true;
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot();
+  state.errors += 1;
+  state.skipped += nb;
+  for(int i = 0; i < sinks.size(); i++)
+    sinks[i]->readError(state, s, nb);
+}
+
+void Progress::finishFile()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  // The last position is always rendered
+  render();
+  snapshot();
+  updateTiming();
+  for(int i = 0; i < sinks.size(); i++)
+    sinks[i]->fileFinished(state);
+  state.file = NULL;
+}
+
+void Progress::note(const char * what, const std::string & detail)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  snapshot();
+  for(int i = 0; i < sinks.size(); i++)
+    sinks[i]->note(state, what, detail);
+}
@@ -0,0 +1,333 @@
+/**
+    \file progress.hh
+    The Progress class and the various progress reporting sinks
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PROGRESS_H
+#define __PROGRESS_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+class DVDFileData;
+
+/// A snapshot of the progress of the copy, as seen by the
+/// ProgressSink objects.
+class ProgressState {
+public:
+
+  /// The current phase (copy, second-pass, scan...)
+  std::string phase;
+
+  /// The file being read, or NULL if none
+  const DVDFileData * file;
+
+  /// The current sector within the file
+  int sector;
+
+  /// The total number of sectors in the file
+  int fileSectors;
+
+  /// The first sector read in the file
+  int firstSector;
+
+  /// The sector at which the reading stops
+  int endSector;
+
+  /// The number of sectors read at a time
+  int steps;
+
+  /// The time elapsed since the beginning of the file, in seconds
+  double elapsed;
+
+  /// The estimated total time for reading the file, in seconds
+  double estimated;
+
+  /// The reading rate, in bytes per second
+  double rate;
+
+  /// The number of read errors since the beginning of the run
+  int errors;
+
+  /// The number of sectors skipped since the beginning of the run
+  int skipped;
+
+  /// The total number of sectors to be processed during the run
+  long runSectors;
+
+  /// The number of sectors processed so far (read, skipped, or
+  /// found already present in the target)
+  long runDone;
+
+  /// The time elapsed since the beginning of the run, in seconds
+  double runElapsed;
+
+  /// The estimated remaining time for the run, in seconds, or -1 if
+  /// unknown
+  double runRemaining;
+
+  /// The reading rate over the last few moments, in bytes per second
+  double windowRate;
+
+  /// The time spent in successful reads, in seconds
+  double readTime;
+
+  /// The time spent in failed reads, in seconds
+  double errorTime;
+
+  ProgressState() : file(NULL), sector(0), fileSectors(0),
+                    firstSector(0), endSector(0), steps(0), elapsed(0),
+                    estimated(0), rate(0), errors(0), skipped(0),
+                    runSectors(0), runDone(0), runElapsed(0),
+                    runRemaining(-1), windowRate(0),
+                    readTime(0), errorTime(0) {;};
+};
+
+/// Something that reports progress in a way or another.
+class ProgressSink {
+public:
+
+  /// The phase changed, @a detail gives more information, if not
+  /// empty.
+  virtual void phaseChanged(const ProgressState & state,
+                            const std::string & detail) {;};
+
+  /// Starting to read a file
+  virtual void fileStarted(const ProgressState & state) {;};
+
+  /// About to read the given sectors. Called from the rendering
+  /// thread of Progress, just before progress().
+  virtual void reading(const ProgressState & state) {;};
+
+  /// Some sectors were read (successfully or not). Called from the
+  /// rendering thread of Progress, a few times a second at most, and
+  /// once more at the end of each file.
+  virtual void progress(const ProgressState & state) {;};
+
+  /// The read of @a nb sectors at @a sector failed
+  virtual void readError(const ProgressState & state,
+                         int sector, int nb) {;};
+
+  /// Done reading the current file
+  virtual void fileFinished(const ProgressState & state) {;};
+
+  /// Something worth noting happened, outside of the reading loop
+  virtual void note(const ProgressState & state, const char * what,
+                    const std::string & detail) {;};
+
+  virtual ~ProgressSink() {;};
+};
+
+/// The good old progress line on the terminal
+class TerminalProgress : public ProgressSink {
+public:
+  virtual void fileStarted(const ProgressState & state);
+  virtual void reading(const ProgressState & state);
+  virtual void progress(const ProgressState & state);
+  virtual void readError(const ProgressState & state, int sector, int nb);
+};
+
+/// A stream of events written as JSON lines, either on a file
+/// descriptor or to a UNIX socket, for use by orchestration tools.
+///
+/// Progress events are emitted at most once every @a interval
+/// seconds, while the other events are always emitted.
+class EventStream : public ProgressSink {
+  /// The file descriptor
+  int fd;
+
+  /// Whether we need to close the file descriptor at the end
+  bool owned;
+
+  /// Whether the descriptor is a socket
+  bool isSocket;
+
+  /// The minimum interval between two progress events
+  double interval;
+
+  /// The time of the last progress event (in seconds of the
+  /// monotonic clock)
+  double lastProgress;
+
+  /// Writes out a single line.
+  void emit(const std::string & line);
+
+  /// Starts a JSON event line with the common fields.
+  std::string startEvent(const char * name, const ProgressState & state);
+
+  EventStream(int fd, bool owned, bool socket);
+
+public:
+
+  /// Writes events to the given file descriptor
+  static EventStream * toDescriptor(int fd);
+
+  /// Connects to the UNIX socket at @a path and writes events there.
+  static EventStream * toSocket(const char * path);
+
+  /// Sets the minimum interval between two progress events
+  void setInterval(double seconds) { interval = seconds; };
+
+  virtual void phaseChanged(const ProgressState & state,
+                            const std::string & detail);
+  virtual void fileStarted(const ProgressState & state);
+  virtual void progress(const ProgressState & state);
+  virtual void readError(const ProgressState & state, int sector, int nb);
+  virtual void fileFinished(const ProgressState & state);
+  virtual void note(const ProgressState & state, const char * what,
+                    const std::string & detail);
+
+  virtual ~EventStream();
+
+  /// Quotes the string for use in JSON
+  static std::string quote(const std::string & str);
+};
+
+/// Collects the progress information from the reading loop and
+/// dispatches it to all the sinks.
+///
+/// The reading loop only publishes the current sector and the time
+/// spent reading through atomics: reading() and advance() neither
+/// format, nor allocate, nor take a lock. A separate thread renders
+/// the progress to the sinks at a fixed rate, so that reading sector
+/// by sector doesn't mean writing to the terminal after each sector.
+/// The other events are rare, and are dispatched right away; the
+/// sinks are always called with the mutex held, so they never run
+/// concurrently.
+class Progress {
+  /// The sinks, owned by this object.
+  std::vector<ProgressSink *> sinks;
+
+  /// The state, as last rendered. Protected by the mutex.
+  ProgressState state;
+
+  /// The values updated by the reading loop, copied to the state when
+  /// rendering.
+  std::atomic<int> sector;
+  std::atomic<long> runDone;
+  std::atomic<double> readTime;
+  std::atomic<double> errorTime;
+
+  /// The position when the progress was last rendered
+  int renderedSector;
+  long renderedDone;
+
+  /// Protects the state and the sinks
+  mutable std::mutex mutex;
+
+  /// The thread rendering the progress, started with the first file
+  std::thread renderer;
+
+  /// Wakes up the renderer when stopping
+  std::condition_variable wake;
+
+  /// Whether the renderer must stop
+  bool stopping;
+
+  /// The delay between two renderings, in seconds
+  double refresh;
+
+  /// The body of the renderer thread
+  void renderLoop();
+
+  /// Copies the values of the reading loop into the state. Must be
+  /// called with the mutex held.
+  void snapshot();
+
+  /// Updates the state and sends it to the sinks, if there was any
+  /// progress since the last time. Must be called with the mutex
+  /// held.
+  void render();
+
+  /// The starting time of the current file
+  double fileStart;
+
+  /// The starting time of the run
+  double runStart;
+
+  /// The time at which the current read started
+  double readStart;
+
+  /// Whether the current read failed
+  bool readFailed;
+
+  /// The duration of the window over which windowRate is computed
+  double window;
+
+  /// The (time, sectors processed) samples within the window, one
+  /// per rendering
+  std::deque<std::pair<double, long> > samples;
+
+  /// Updates the timing information in the state.
+  void updateTiming();
+
+public:
+
+  Progress();
+
+  /// Adds a sink, that will be deleted with this object.
+  void addSink(ProgressSink * sink);
+
+  /// Changes the current phase
+  void setPhase(const char * phase, const std::string & detail = "");
+
+  /// Starts a run in which @a sectors sectors are to be processed,
+  /// which resets the run-level accounting.
+  void startRun(long sectors);
+
+  /// Accounts for @a sectors sectors that don't need reading
+  /// (already present in the target, for instance).
+  void alreadyDone(long sectors);
+
+  /// Sets the duration of the window over which the rate used for
+  /// the estimation of the remaining time is computed.
+  void setWindow(double seconds) { window = seconds; };
+
+  /// Starts reading the sectors from @a start to @a end (excluded)
+  /// in @a dat, @a steps at a time (out of a total of @a total
+  /// sectors in the file).
+  void startFile(const DVDFileData * dat, int start, int end, int total,
+                 int steps);
+
+  /// About to read at @a sector. Called by the reading loop, cheap.
+  void reading(int sector);
+
+  /// The current position is now @a sector. Called by the reading
+  /// loop, cheap.
+  void advance(int sector);
+
+  /// Failed to read @a nb sectors at @a sector
+  void readError(int sector, int nb);
+
+  /// Done with the file
+  void finishFile();
+
+  /// Reports an event named @a what, with the given details
+  void note(const char * what, const std::string & detail = "");
+
+  /// The current state
+  ProgressState current() const;
+
+  ~Progress();
+
+  /// Returns the current time of the monotonic clock, in seconds.
+  static double now();
+};
+
+#endif
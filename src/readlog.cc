@@ -0,0 +1,114 @@
+/**
+    \file readlog.cc
+    Implementation of the ReadLog class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "readlog.hh"
+
+static const char magic[] = "DVDRLOG1";
+
+static void put16(unsigned char * buf, uint16_t v)
+{
+  buf[0] = v & 0xFF;
+  buf[1] = v >> 8;
+}
+
+static void put32(unsigned char * buf, uint32_t v)
+{
+  put16(buf, v & 0xFFFF);
+  put16(buf + 2, v >> 16);
+}
+
+static uint16_t get16(const unsigned char * buf)
+{
+  return (uint16_t) buf[0] | ((uint16_t) buf[1] << 8);
+}
+
+static uint32_t get32(const unsigned char * buf)
+{
+  return (uint32_t) get16(buf) | ((uint32_t) get16(buf + 2) << 16);
+}
+
+ReadLog::ReadLog(const char * fileName)
+{
+  file = fopen(fileName, "wb");
+  if(! file) {
+    std::string err = "Could not open read log '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fwrite(magic, 8, 1, file);
+}
+
+ReadLog::~ReadLog()
+{
+  fclose(file);
+}
+
+void ReadLog::record(const ReadLogEntry & e)
+{
+  unsigned char buf[recordSize];
+  memset(buf, 0, sizeof(buf));
+  put32(buf, e.lba >= 0 ? (uint32_t) e.lba : 0xFFFFFFFF);
+  put32(buf + 4, e.offset);
+  put32(buf + 8, e.usec);
+  put16(buf + 12, e.blocks);
+  put16(buf + 14, e.result >= 0 ? e.result : 0xFFFF);
+  buf[16] = e.title;
+  buf[17] = e.domain;
+  fwrite(buf, sizeof(buf), 1, file);
+}
+
+std::vector<ReadLogEntry> ReadLog::load(const char * fileName)
+{
+  FILE * f = fopen(fileName, "rb");
+  if(! f) {
+    std::string err = "Could not open read log '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  char m[8];
+  if(fread(m, 8, 1, f) != 1 || memcmp(m, magic, 8)) {
+    fclose(f);
+    std::string err = "Not a read log: ";
+    err += fileName;
+    throw std::runtime_error(err);
+  }
+  std::vector<ReadLogEntry> ret;
+  unsigned char buf[recordSize];
+  while(fread(buf, sizeof(buf), 1, f) == 1) {
+    ReadLogEntry e;
+    uint32_t lba = get32(buf);
+    e.lba = (lba == 0xFFFFFFFF ? -1 : lba);
+    e.offset = get32(buf + 4);
+    e.usec = get32(buf + 8);
+    e.blocks = get16(buf + 12);
+    e.result = get16(buf + 14);
+    if(e.result == 0xFFFF)
+      e.result = -1;
+    e.title = buf[16];
+    e.domain = buf[17];
+    ret.push_back(e);
+  }
+  fclose(f);
+  return ret;
+}
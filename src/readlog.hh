@@ -0,0 +1,84 @@
+/**
+    \file readlog.hh
+    The ReadLog class, a compact binary log of all read attempts
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __READLOG_H
+#define __READLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/// A single read attempt, as stored in the log.
+class ReadLogEntry {
+public:
+  /// The absolute sector of the start of the read on the disc, or -1
+  /// if unknown.
+  int64_t lba;
+
+  /// The titleset of the file read
+  int title;
+
+  /// The domain of the file read
+  int domain;
+
+  /// The offset within the file, in sectors
+  int offset;
+
+  /// The number of sectors requested
+  int blocks;
+
+  /// The number of sectors read, or -1 if the read failed
+  int result;
+
+  /// The duration of the read, in microseconds
+  uint32_t usec;
+};
+
+/// A binary log of read attempts.
+///
+/// The file starts with the 8 bytes "DVDRLOG1", followed by records
+/// of 24 bytes, all little-endian:
+///  - 4 bytes: start sector on the disc (0xFFFFFFFF if unknown)
+///  - 4 bytes: offset within the file
+///  - 4 bytes: duration in microseconds
+///  - 2 bytes: number of sectors requested
+///  - 2 bytes: number of sectors read (0xFFFF on error)
+///  - 1 byte: titleset
+///  - 1 byte: domain
+///  - 6 bytes: reserved
+class ReadLog {
+  /// The file written to
+  FILE * file;
+
+public:
+  /// The size of a record
+  static const int recordSize = 24;
+
+  /// Opens @a fileName for writing, truncating it.
+  ReadLog(const char * fileName);
+
+  /// Appends an entry
+  void record(const ReadLogEntry & entry);
+
+  ~ReadLog();
+
+  /// Reads all the entries from the given file.
+  static std::vector<ReadLogEntry> load(const char * fileName);
+};
+
+#endif
@@ -0,0 +1,420 @@
+/**
+    \file readsim.cc
+    readsim, replays a read log to evaluate other reading strategies
+    Copyright Vincent Fourmond, 2026
+
+    This is dvdcopy, a wrapper around libreaddvd facilities for
+    reading DVDs.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+    02111-1307 USA
+*/
+
+#include "headers.hh"
+#include "readlog.hh"
+
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <algorithm>
+
+// This program takes a read log written by dvdcopy --read-log and
+// builds a model of the disc from it: which sectors are known to be
+// good, which are known to be bad, and how long good and failed
+// reads take. It then simulates a copy with other settings, to
+// estimate the time it would take and how many sectors it would
+// recover, without wearing the disc any further.
+
+/// What we know about a sector
+enum SectorStatus {
+  Unknown = 0,                  // Never read, assumed to be good
+  Good,                         // Read successfully at least once
+  Bad,                          // Failed a single-sector read
+  Suspect                       // Part of a failed multi-sector read
+};
+
+/// The model of a file
+class FileModel {
+public:
+  int title;
+  int domain;
+
+  /// The status of each sector
+  std::vector<char> status;
+
+  /// The number of bad (or suspect) sectors up to the given index
+  /// (excluded)
+  std::vector<int> badBefore;
+
+  /// The rank of the first read of that file in the log
+  int rank;
+
+  /// Whether the sector at the given index is considered bad
+  bool isBad(int i) const {
+    return status[i] == Bad || status[i] == Suspect;
+  };
+
+  /// Number of bad sectors in [start, start+nb)
+  int bad(int start, int nb) const {
+    return badBefore[start + nb] - badBefore[start];
+  };
+
+  void ensureSize(int sz) {
+    if(status.size() < sz)
+      status.resize(sz, Unknown);
+  };
+};
+
+/// The cost model for reads
+class CostModel {
+public:
+  /// Successful reads take fixed + perSector * sectors
+  double fixed, perSector;
+
+  /// Failed reads take that
+  double failure;
+};
+
+/// One simulated strategy
+class Strategy {
+public:
+  int chunk;
+  int skipAhead;
+  std::string order;
+  bool retry;
+};
+
+/// The outcome of a simulation
+class Outcome {
+public:
+  double time;
+  long recovered;
+  long lost;
+  long reads;
+  bool finished;
+};
+
+static std::vector<int> parseList(const char * str)
+{
+  std::vector<int> ret;
+  std::string s(str);
+  size_t pos = 0;
+  while(pos < s.size()) {
+    size_t next = s.find(',', pos);
+    if(next == std::string::npos)
+      next = s.size();
+    ret.push_back(atoi(s.substr(pos, next - pos).c_str()));
+    pos = next + 1;
+  }
+  return ret;
+}
+
+static double median(std::vector<double> v)
+{
+  if(v.empty())
+    return -1;
+  std::sort(v.begin(), v.end());
+  return v[v.size()/2];
+}
+
+/// Builds the models of the files and the cost model from the log.
+static void buildModel(const std::vector<ReadLogEntry> & log,
+                       std::vector<FileModel> & files,
+                       CostModel & cost)
+{
+  std::map<std::pair<int, int>, int> index;
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  int n = 0;
+  std::vector<double> failures;
+
+  for(int i = 0; i < log.size(); i++) {
+    const ReadLogEntry & e = log[i];
+    std::pair<int, int> key(e.title, e.domain);
+    if(! index.count(key)) {
+      index[key] = files.size();
+      FileModel m;
+      m.title = e.title;
+      m.domain = e.domain;
+      m.rank = files.size();
+      files.push_back(m);
+    }
+    FileModel & f = files[index[key]];
+    f.ensureSize(e.offset + e.blocks);
+    if(e.result >= 0) {
+      for(int j = 0; j < e.result; j++)
+        f.status[e.offset + j] = Good;
+      if(e.result > 0) {
+        sx += e.result;
+        sy += e.usec;
+        sxx += 1.0 * e.result * e.result;
+        sxy += 1.0 * e.result * e.usec;
+        n++;
+      }
+    }
+    else {
+      failures.push_back(e.usec);
+      for(int j = 0; j < e.blocks; j++) {
+        char & s = f.status[e.offset + j];
+        if(e.blocks == 1 && s != Good)
+          s = Bad;
+        else if(s == Unknown)
+          s = Suspect;
+      }
+    }
+  }
+
+  for(int i = 0; i < files.size(); i++) {
+    FileModel & f = files[i];
+    f.badBefore.resize(f.status.size() + 1);
+    f.badBefore[0] = 0;
+    for(int j = 0; j < f.status.size(); j++)
+      f.badBefore[j+1] = f.badBefore[j] + (f.isBad(j) ? 1 : 0);
+  }
+
+  // Linear regression of the duration of successful reads against
+  // their size.
+  double det = n * sxx - sx * sx;
+  if(n > 1 && det > 0) {
+    cost.perSector = (n * sxy - sx * sy)/det;
+    cost.fixed = (sy - cost.perSector * sx)/n;
+  }
+  else {
+    cost.perSector = (sx > 0 ? sy/sx : 500);
+    cost.fixed = 0;
+  }
+  if(cost.perSector < 0)
+    cost.perSector = 0;
+  if(cost.fixed < 0)
+    cost.fixed = 0;
+  cost.failure = median(failures);
+  if(cost.failure < 0)
+    cost.failure = 1e6;         // A second is a good guess
+}
+
+static Outcome simulate(const std::vector<FileModel> & models,
+                        const CostModel & cost, const Strategy & st,
+                        double budget)
+{
+  std::vector<const FileModel *> files;
+  for(int i = 0; i < models.size(); i++)
+    files.push_back(&models[i]);
+  if(st.order == "largest-first")
+    std::stable_sort(files.begin(), files.end(),
+                     [](const FileModel * a, const FileModel * b) {
+                       return a->status.size() > b->status.size();
+                     });
+  else if(st.order == "cleanest-first")
+    std::stable_sort(files.begin(), files.end(),
+                     [](const FileModel * a, const FileModel * b) {
+                       return 1.0 * a->badBefore.back() / a->status.size() <
+                         1.0 * b->badBefore.back() / b->status.size();
+                     });
+
+  Outcome o;
+  o.time = 0;
+  o.recovered = 0;
+  o.lost = 0;
+  o.reads = 0;
+  o.finished = true;
+
+  std::vector<std::pair<const FileModel *, std::pair<int, int> > > missed;
+  for(int i = 0; i < files.size() && o.finished; i++) {
+    const FileModel * f = files[i];
+    int size = f->status.size();
+    int pos = 0;
+    while(pos < size) {
+      if(budget > 0 && o.time > budget) {
+        o.finished = false;
+        break;
+      }
+      int nb = std::min(st.chunk, size - pos);
+      o.reads++;
+      if(f->bad(pos, nb)) {
+        o.time += cost.failure;
+        int skip = std::min(st.skipAhead, size - pos - nb);
+        missed.push_back(std::make_pair(f, std::make_pair(pos, nb + skip)));
+        pos += nb + skip;
+      }
+      else {
+        o.time += cost.fixed + cost.perSector * nb;
+        o.recovered += nb;
+        pos += nb;
+      }
+    }
+  }
+
+  if(st.retry) {
+    for(int i = 0; i < missed.size() && o.finished; i++) {
+      const FileModel * f = missed[i].first;
+      for(int j = 0; j < missed[i].second.second; j++) {
+        if(budget > 0 && o.time > budget) {
+          o.finished = false;
+          break;
+        }
+        o.reads++;
+        if(f->isBad(missed[i].second.first + j))
+          o.time += cost.failure;
+        else {
+          o.time += cost.fixed + cost.perSector;
+          o.recovered++;
+        }
+      }
+    }
+  }
+
+  long total = 0;
+  for(int i = 0; i < models.size(); i++)
+    total += models[i].status.size();
+  o.lost = total - o.recovered;
+  return o;
+}
+
+static std::string formatTime(double usec)
+{
+  char buffer[30];
+  int s = (int) (usec * 1e-6);
+  snprintf(buffer, sizeof(buffer), "%d:%02d:%02d",
+           s / 3600, (s / 60) % 60, s % 60);
+  return std::string(buffer);
+}
+
+void printHelp(const char * progname)
+{
+  std::cout << "Usage: " << progname
+            << " [options] readlog\n\n"
+            << "Replays a log written by dvdcopy --read-log and estimates "
+            << "the\nduration and outcome of a copy with other settings\n\n"
+            << "Options: \n"
+            << " -h, --help: print this help message\n"
+            << " -n, --number LIST: sectors read at a time (comma-separated)\n"
+            << " -k, --skip-ahead LIST: sectors skipped after a failure\n"
+            << " -o, --order LIST: disc, largest-first or cleanest-first\n"
+            << " -b, --budget SECS: stop the simulation after SECS seconds\n"
+            << " -R, --no-retry: do not simulate a second pass\n";
+}
+
+static struct option long_options[] = {
+  { "help", 0, NULL, 'h'},
+  { "number", 1, NULL, 'n' },
+  { "skip-ahead", 1, NULL, 'k' },
+  { "order", 1, NULL, 'o' },
+  { "budget", 1, NULL, 'b' },
+  { "no-retry", 0, NULL, 'R' },
+  { NULL, 0, NULL, 0}
+};
+
+int main(int argc, char ** argv)
+{
+  std::vector<int> chunks = parseList("1,16,32,64,128,256");
+  std::vector<int> skips = parseList("0");
+  std::vector<std::string> orders;
+  orders.push_back("disc");
+  double budget = -1;
+  bool retry = true;
+
+  int option;
+  do {
+    option = getopt_long(argc, argv, "hn:k:o:b:R", long_options, NULL);
+    switch(option) {
+    case 'h':
+      printHelp(argv[0]);
+      return 0;
+    case 'n':
+      chunks = parseList(optarg);
+      break;
+    case 'k':
+      skips = parseList(optarg);
+      break;
+    case 'o': {
+      orders.clear();
+      std::string s(optarg);
+      size_t pos = 0;
+      while(pos < s.size()) {
+        size_t next = s.find(',', pos);
+        if(next == std::string::npos)
+          next = s.size();
+        orders.push_back(s.substr(pos, next - pos));
+        pos = next + 1;
+      }
+    }
+      break;
+    case 'b':
+      budget = atof(optarg) * 1e6;
+      break;
+    case 'R':
+      retry = false;
+      break;
+    }
+  } while(option != -1);
+  if(argc != optind + 1) {
+    printHelp(argv[0]);
+    return 1;
+  }
+
+  try {
+    std::vector<ReadLogEntry> log = ReadLog::load(argv[optind]);
+    std::vector<FileModel> files;
+    CostModel cost;
+    buildModel(log, files, cost);
+
+    long total = 0, bad = 0, suspect = 0, unknown = 0;
+    double actual = 0;
+    for(int i = 0; i < log.size(); i++)
+      actual += log[i].usec;
+    for(int i = 0; i < files.size(); i++) {
+      for(int j = 0; j < files[i].status.size(); j++) {
+        total++;
+        switch(files[i].status[j]) {
+        case Bad: bad++; break;
+        case Suspect: suspect++; break;
+        case Unknown: unknown++; break;
+        default: ;
+        }
+      }
+    }
+    printf("%ld reads in the log, %s spent reading\n", (long) log.size(),
+           formatTime(actual).c_str());
+    printf("%d files, %ld sectors: %ld bad, %ld suspect "
+           "(counted as bad), %ld never read (counted as good)\n",
+           (int) files.size(), total, bad, suspect, unknown);
+    printf("Cost model: %.0fus + %.0fus/sector for good reads, "
+           "%.0fus for failed reads\n\n",
+           cost.fixed, cost.perSector, cost.failure);
+
+    printf("%8s %8s %-15s %10s %10s %10s %9s\n", "chunk", "skip",
+           "order", "time", "recovered", "lost", "reads");
+    for(int i = 0; i < chunks.size(); i++) {
+      for(int j = 0; j < skips.size(); j++) {
+        for(int k = 0; k < orders.size(); k++) {
+          Strategy st;
+          st.chunk = chunks[i] > 0 ? chunks[i] : 1;
+          st.skipAhead = skips[j] > 0 ? skips[j] : 0;
+          st.order = orders[k];
+          st.retry = retry;
+          Outcome o = simulate(files, cost, st, budget);
+          printf("%8d %8d %-15s %10s %10ld %10ld %9ld%s\n",
+                 st.chunk, st.skipAhead, st.order.c_str(),
+                 formatTime(o.time).c_str(), o.recovered, o.lost, o.reads,
+                 o.finished ? "" : " (budget exceeded)");
+        }
+      }
+    }
+  }
+  catch(const std::exception & e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,492 @@
+/**
+    \file readstats.cc
+    Implementation of the ReadStatistics and LatencyHistogram classes
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "readstats.hh"
+#include "dvdreader.hh"
+#include "readlog.hh"
+
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include <algorithm>
+
+LatencyHistogram::LatencyHistogram() :
+  counts(subBuckets + magnitudes * subBuckets/2, 0),
+  total(0), largest(0)
+{
+}
+
+int LatencyHistogram::indexFor(long value)
+{
+  if(value < 0)
+    value = 0;
+  if(value < subBuckets)
+    return value;
+  // Position of the highest bit, shifted so that the remaining value
+  // lies within [subBuckets/2, subBuckets)
+  int shift = 0;
+  while((value >> shift) >= subBuckets)
+    shift++;
+  int idx = subBuckets + (shift - 1) * subBuckets/2 +
+    (value >> shift) - subBuckets/2;
+  if(idx >= subBuckets + magnitudes * subBuckets/2)
+    idx = subBuckets + magnitudes * subBuckets/2 - 1;
+  return idx;
+}
+
+long LatencyHistogram::valueFor(int index)
+{
+  if(index < subBuckets)
+    return index;
+  int shift = 1 + (index - subBuckets) / (subBuckets/2);
+  long base = (index - subBuckets) % (subBuckets/2) + subBuckets/2;
+  return ((base + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(long usec)
+{
+  counts[indexFor(usec)] += 1;
+  total += 1;
+  if(usec > largest)
+    largest = usec;
+}
+
+long LatencyHistogram::percentile(double p) const
+{
+  if(! total)
+    return 0;
+  unsigned long target = (unsigned long) ceil(p * total);
+  if(target < 1)
+    target = 1;
+  unsigned long seen = 0;
+  for(int i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if(seen >= target)
+      return std::min(valueFor(i), largest);
+  }
+  return largest;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram & other)
+{
+  for(int i = 0; i < counts.size(); i++)
+    counts[i] += other.counts[i];
+  total += other.total;
+  if(other.largest > largest)
+    largest = other.largest;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+ReadStatistics::ReadStatistics() : phaseStart(timestamp())
+{
+}
+
+ReadStatistics::~ReadStatistics()
+{
+}
+
+void ReadStatistics::setReadLog(const char * file)
+{
+  readLog.reset(new ReadLog(file));
+}
+
+PhaseStatistics & ReadStatistics::currentPhase()
+{
+  if(phases.empty())
+    setPhase("run");
+  return phases.back();
+}
+
+void ReadStatistics::updateWallTime()
+{
+  if(! phases.empty())
+    phases.back().wallTime = timestamp() - phaseStart;
+}
+
+void ReadStatistics::setPhase(const std::string & name)
+{
+  updateWallTime();
+  phases.push_back(PhaseStatistics(name));
+  phaseStart = timestamp();
+}
+
+void ReadStatistics::recordWrite(int sectors, long usec)
+{
+  PhaseStatistics & ph = currentPhase();
+  ph.writes += 1;
+  ph.sectorsWritten += sectors;
+  ph.writeTime += usec;
+}
+
+long ReadStatistics::timestamp()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void ReadStatistics::recordRead(const DVDFileData * dat, int offset,
+                                int blocks, int result, long usec)
+{
+  bool success = result >= 0;
+  if(readLog) {
+    ReadLogEntry e;
+    e.lba = (dat->startSector >= 0 ? dat->startSector + offset : -1);
+    e.title = dat->title;
+    e.domain = dat->domain;
+    e.offset = offset;
+    e.blocks = blocks;
+    e.result = result;
+    e.usec = usec;
+    readLog->record(e);
+  }
+  // A short read fails for the sectors it didn't return
+  int read = std::max(std::min(result, blocks), 0);
+  reads.push_back(Read(dat, offset, blocks, read, success, usec));
+  titlesets[dat->title].record(usec);
+  TitlesetAmounts & a = amounts[dat->title];
+  PhaseStatistics & ph = currentPhase();
+  ph.reads += 1;
+  a.sectorsRead += read;
+  a.sectorsFailed += blocks - read;
+  ph.sectorsRead += read;
+  ph.sectorsFailed += blocks - read;
+  if(success)
+    ph.readTime += usec;
+  else {
+    ph.failedReads += 1;
+    ph.failedReadTime += usec;
+  }
+}
+
+void ReadStatistics::merge(const ReadStatistics & other)
+{
+  for(std::map<int, LatencyHistogram>::const_iterator i =
+        other.titlesets.begin(); i != other.titlesets.end(); i++)
+    titlesets[i->first].merge(i->second);
+  for(std::map<int, TitlesetAmounts>::const_iterator i =
+        other.amounts.begin(); i != other.amounts.end(); i++) {
+    amounts[i->first].sectorsRead += i->second.sectorsRead;
+    amounts[i->first].sectorsFailed += i->second.sectorsFailed;
+  }
+  PhaseStatistics & ph = currentPhase();
+  for(int i = 0; i < other.phases.size(); i++) {
+    const PhaseStatistics & o = other.phases[i];
+    ph.reads += o.reads;
+    ph.failedReads += o.failedReads;
+    ph.sectorsRead += o.sectorsRead;
+    ph.sectorsFailed += o.sectorsFailed;
+    ph.readTime += o.readTime;
+    ph.failedReadTime += o.failedReadTime;
+    ph.writes += o.writes;
+    ph.sectorsWritten += o.sectorsWritten;
+    ph.writeTime += o.writeTime;
+  }
+}
+
+/// Formats a duration given in microseconds
+static std::string formatLatency(long usec)
+{
+  char buffer[30];
+  if(usec >= 1000000)
+    snprintf(buffer, sizeof(buffer), "%.2fs", usec * 1e-6);
+  else if(usec >= 1000)
+    snprintf(buffer, sizeof(buffer), "%.1fms", usec * 1e-3);
+  else
+    snprintf(buffer, sizeof(buffer), "%ldus", usec);
+  return std::string(buffer);
+}
+
+void ReadStatistics::displayHistograms() const
+{
+  if(titlesets.empty())
+    return;
+  printf("\nRead latencies:\n");
+  for(std::map<int, LatencyHistogram>::const_iterator i = titlesets.begin();
+      i != titlesets.end(); i++) {
+    const LatencyHistogram & h = i->second;
+    printf(" titleset %2d: %7lu reads, p50 %8s, p99 %8s, max %8s\n",
+           i->first, h.count(),
+           formatLatency(h.percentile(0.5)).c_str(),
+           formatLatency(h.percentile(0.99)).c_str(),
+           formatLatency(h.maximum()).c_str());
+  }
+}
+
+long ReadStatistics::layout(const std::vector<DVDFileData *> & files,
+                            std::map<const DVDFileData *, long> & positions)
+{
+  long next = 0;
+  for(int i = 0; i < files.size(); i++) {
+    const DVDFileData * dat = files[i];
+    if(dat->dup) {
+      positions[dat] = positions[dat->dup];
+      continue;
+    }
+    long sectors = (dat->size + 2047)/2048;
+    long pos = (dat->startSector >= 0 ? dat->startSector : next);
+    positions[dat] = pos;
+    if(pos + sectors > next)
+      next = pos + sectors;
+  }
+  return next;
+}
+
+void ReadStatistics::writeLatencyMap(const char * fileName,
+                                     const std::vector<DVDFileData *> &
+                                     files) const
+{
+  std::map<const DVDFileData *, long> positions;
+  layout(files, positions);
+
+  std::vector<std::pair<long, const Read *> > sorted;
+  for(int i = 0; i < reads.size(); i++)
+    sorted.push_back(std::make_pair(positions[reads[i].file] +
+                                    reads[i].offset, &reads[i]));
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<long, const Read *> & a,
+                      const std::pair<long, const Read *> & b) {
+                     return a.first < b.first;
+                   });
+
+  FILE * out = fopen(fileName, "w");
+  if(! out) {
+    std::string err = "Could not open latency map file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "# sector\tnumber\tlatency(us)\tstatus\tfile\toffset\n");
+  for(int i = 0; i < sorted.size(); i++) {
+    const Read * r = sorted[i].second;
+    fprintf(out, "%ld\t%d\t%ld\t%s\t%s\t%d\n",
+            sorted[i].first, r->blocks, r->usec,
+            ! r->success ? "error" : (r->sectors < r->blocks ? "short" : "ok"),
+            r->file->fileName(true, r->offset).c_str(), r->offset);
+  }
+  fclose(out);
+}
+
+void ReadStatistics::writeHeatmap(const char * fileName,
+                                  const std::vector<DVDFileData *> &
+                                  files) const
+{
+  std::map<const DVDFileData *, long> positions;
+  long total = layout(files, positions);
+
+  const int width = 512;
+  long perPixel = (total + width * width - 1) / (width * width);
+  if(perPixel < 1)
+    perPixel = 1;
+  long pixels = (total + perPixel - 1) / perPixel;
+  int height = (pixels + width - 1) / width;
+  if(height < 1)
+    height = 1;
+
+  // Worst latency per sector seen in each pixel, -1 for errors, 0
+  // for unread
+  std::vector<double> worst(width * height, 0);
+  double lowest = -1, highest = -1;
+  for(int i = 0; i < reads.size(); i++) {
+    const Read & r = reads[i];
+    long start = positions[r.file] + r.offset;
+    double perSector = r.usec * 1.0 / (r.blocks > 0 ? r.blocks : 1);
+    if(perSector <= 0)
+      perSector = 1e-3;
+    if(r.success) {
+      if(lowest < 0 || perSector < lowest)
+        lowest = perSector;
+      if(perSector > highest)
+        highest = perSector;
+    }
+    for(long p = start/perPixel;
+        p <= (start + r.blocks - 1)/perPixel && p < worst.size(); p++) {
+      // The sectors a short read didn't return count as errors
+      if(! r.success || (r.sectors < r.blocks &&
+                         (p + 1) * perPixel > start + r.sectors))
+        worst[p] = -1;
+      else if(worst[p] >= 0 && perSector > worst[p])
+        worst[p] = perSector;
+    }
+  }
+
+  FILE * out = fopen(fileName, "wb");
+  if(! out) {
+    std::string err = "Could not open heatmap file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(out, "P6\n# %ld sectors per pixel, %g to %g us per sector\n"
+          "%d %d\n255\n", perPixel, lowest, highest, width, height);
+  double range = (highest > lowest ? log(highest/lowest) : 1);
+  for(int i = 0; i < worst.size(); i++) {
+    unsigned char rgb[3] = {0, 0, 0};
+    if(worst[i] < 0)
+      rgb[0] = 255;
+    else if(worst[i] > 0) {
+      // Logarithmic scale: blue -> green -> yellow
+      double t = log(worst[i]/lowest)/range;
+      if(t < 0.5) {
+        rgb[1] = (unsigned char) (510 * t);
+        rgb[2] = (unsigned char) (255 - 510 * t);
+      }
+      else {
+        rgb[0] = (unsigned char) (510 * (t - 0.5));
+        rgb[1] = 255;
+      }
+    }
+    fwrite(rgb, 3, 1, out);
+  }
+  fclose(out);
+}
+
+std::vector<const ReadStatistics::Read *>
+ReadStatistics::largestStalls(int nb) const
+{
+  std::vector<const Read *> ret;
+  for(int i = 0; i < reads.size(); i++)
+    ret.push_back(&reads[i]);
+  if(nb > ret.size())
+    nb = ret.size();
+  std::partial_sort(ret.begin(), ret.begin() + nb, ret.end(),
+                    [](const Read * a, const Read * b) {
+                      return a->usec > b->usec;
+                    });
+  ret.resize(nb);
+  return ret;
+}
+
+/// Returns a rate in MB/s, for the given number of sectors in the
+/// given number of microseconds
+static double megabytesPerSecond(long sectors, long usec)
+{
+  if(usec <= 0)
+    return 0;
+  return sectors * 2048. / usec;
+}
+
+void ReadStatistics::displayReport()
+{
+  updateWallTime();
+
+  printf("\nRun report:\n");
+  for(std::map<int, TitlesetAmounts>::iterator i = amounts.begin();
+      i != amounts.end(); i++)
+    printf(" titleset %2d: %8ld sectors read (%.1f MB), %ld failed\n",
+           i->first, i->second.sectorsRead,
+           i->second.sectorsRead * 2048e-6, i->second.sectorsFailed);
+
+  for(int i = 0; i < phases.size(); i++) {
+    const PhaseStatistics & ph = phases[i];
+    if(! (ph.reads || ph.writes))
+      continue;
+    printf(" phase %s: %s overall, %.1f MB/s effective\n",
+           ph.name.c_str(), formatLatency(ph.wallTime).c_str(),
+           megabytesPerSecond(ph.sectorsRead, ph.wallTime));
+    printf("   %ld reads, %s (%.1f MB/s)\n", ph.reads - ph.failedReads,
+           formatLatency(ph.readTime).c_str(),
+           megabytesPerSecond(ph.sectorsRead, ph.readTime));
+    if(ph.failedReads)
+      printf("   %ld failed reads (%ld sectors), %s\n", ph.failedReads,
+             ph.sectorsFailed, formatLatency(ph.failedReadTime).c_str());
+    printf("   %ld writes, %s (%.1f MB/s)\n", ph.writes,
+           formatLatency(ph.writeTime).c_str(),
+           megabytesPerSecond(ph.sectorsWritten, ph.writeTime));
+  }
+
+  std::vector<const Read *> stalls = largestStalls(5);
+  if(! stalls.empty()) {
+    printf(" largest stalls:\n");
+    for(int i = 0; i < stalls.size(); i++)
+      printf("   %8s for %d sectors at %s:%d%s\n",
+             formatLatency(stalls[i]->usec).c_str(), stalls[i]->blocks,
+             stalls[i]->file->fileName(true, stalls[i]->offset).c_str(),
+             stalls[i]->offset, stalls[i]->success ? "" : " (failed)");
+  }
+}
+
+void ReadStatistics::writeJSONReport(const char * fileName)
+{
+  FILE * out = fopen(fileName, "w");
+  if(! out) {
+    std::string err = "Could not open report file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  writeJSON(out);
+  fclose(out);
+}
+
+void ReadStatistics::writeJSON(FILE * out)
+{
+  updateWallTime();
+  fprintf(out, "{\n  \"titlesets\": [");
+  bool first = true;
+  for(std::map<int, TitlesetAmounts>::iterator i = amounts.begin();
+      i != amounts.end(); i++) {
+    const LatencyHistogram & h = titlesets[i->first];
+    fprintf(out, "%s\n    {\"titleset\": %d, \"sectors_read\": %ld, "
+            "\"bytes_read\": %ld, \"sectors_failed\": %ld, "
+            "\"reads\": %lu, \"p50_us\": %ld, \"p99_us\": %ld, "
+            "\"max_us\": %ld}",
+            first ? "" : ",", i->first, i->second.sectorsRead,
+            i->second.sectorsRead * 2048, i->second.sectorsFailed,
+            h.count(), h.percentile(0.5), h.percentile(0.99),
+            h.maximum());
+    first = false;
+  }
+  fprintf(out, "\n  ],\n  \"phases\": [");
+  first = true;
+  for(int i = 0; i < phases.size(); i++) {
+    const PhaseStatistics & ph = phases[i];
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"wall_us\": %ld, "
+            "\"reads\": %ld, \"failed_reads\": %ld, "
+            "\"sectors_read\": %ld, \"sectors_failed\": %ld, "
+            "\"read_us\": %ld, \"failed_read_us\": %ld, "
+            "\"writes\": %ld, \"sectors_written\": %ld, \"write_us\": %ld, "
+            "\"effective_mbps\": %.3f, \"read_mbps\": %.3f, "
+            "\"write_mbps\": %.3f}",
+            first ? "" : ",", ph.name.c_str(), ph.wallTime,
+            ph.reads, ph.failedReads, ph.sectorsRead, ph.sectorsFailed,
+            ph.readTime, ph.failedReadTime,
+            ph.writes, ph.sectorsWritten, ph.writeTime,
+            megabytesPerSecond(ph.sectorsRead, ph.wallTime),
+            megabytesPerSecond(ph.sectorsRead, ph.readTime),
+            megabytesPerSecond(ph.sectorsWritten, ph.writeTime));
+    first = false;
+  }
+  fprintf(out, "\n  ],\n  \"stalls\": [");
+  std::vector<const Read *> stalls = largestStalls(20);
+  for(int i = 0; i < stalls.size(); i++)
+    fprintf(out, "%s\n    {\"file\": \"%s\", \"offset\": %d, "
+            "\"sectors\": %d, \"us\": %ld, \"success\": %s}",
+            i ? "," : "",
+            stalls[i]->file->fileName(true, stalls[i]->offset).c_str(),
+            stalls[i]->offset, stalls[i]->blocks, stalls[i]->usec,
+            stalls[i]->success ? "true" : "false");
+  fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,244 @@
+/**
+    \file readstats.hh
+    The ReadStatistics class and its latency histograms
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __READSTATS_H
+#define __READSTATS_H
+
+#include <stdio.h>
+
+class DVDFileData;
+class ReadLog;
+
+/// A histogram of latencies (in microseconds), in the spirit of
+/// HdrHistogram: values are stored in logarithmic buckets, each
+/// divided into linear sub-buckets, so that the relative error stays
+/// below 1/32 whatever the magnitude, using a fixed amount of memory.
+class LatencyHistogram {
+  /// Number of linear sub-buckets of the lowest magnitude. All
+  /// values below that are recorded exactly.
+  static const int subBuckets = 64;
+
+  /// Number of magnitudes above the first one (up to 2^40 us, ie
+  /// about 12 days, which should be enough even for the worst
+  /// drives).
+  static const int magnitudes = 35;
+
+  /// The counts
+  std::vector<unsigned long> counts;
+
+  /// The total number of recorded values
+  unsigned long total;
+
+  /// The largest value recorded
+  long largest;
+
+  /// Returns the bucket index for the given value
+  static int indexFor(long value);
+
+  /// Returns the (highest) value represented by the given index
+  static long valueFor(int index);
+
+public:
+
+  LatencyHistogram();
+
+  /// Records the given value
+  void record(long usec);
+
+  /// Returns the value below which the fraction @a p of the recorded
+  /// values lie (@a p is between 0 and 1)
+  long percentile(double p) const;
+
+  /// Returns the largest recorded value
+  long maximum() const { return largest; };
+
+  /// Returns the number of recorded values
+  unsigned long count() const { return total; };
+
+  /// Adds the contents of another histogram to this one.
+  void merge(const LatencyHistogram & other);
+};
+
+/// Counters for one phase of the run (copy, second pass...)
+class PhaseStatistics {
+public:
+  /// The name of the phase
+  std::string name;
+
+  /// Number of read calls, and how many of them failed
+  long reads, failedReads;
+
+  /// Number of sectors successfully read, and that failed
+  long sectorsRead, sectorsFailed;
+
+  /// Time spent in successful and failed reads (microseconds)
+  long readTime, failedReadTime;
+
+  /// Number of write calls and sectors written
+  long writes, sectorsWritten;
+
+  /// Time spent writing (microseconds)
+  long writeTime;
+
+  /// Wall clock time of the phase (microseconds)
+  long wallTime;
+
+  PhaseStatistics(const std::string & n) :
+    name(n), reads(0), failedReads(0), sectorsRead(0), sectorsFailed(0),
+    readTime(0), failedReadTime(0), writes(0), sectorsWritten(0),
+    writeTime(0), wallTime(0) {;};
+};
+
+/// Per-titleset amounts
+class TitlesetAmounts {
+public:
+  long sectorsRead;
+  long sectorsFailed;
+  TitlesetAmounts() : sectorsRead(0), sectorsFailed(0) {;};
+};
+
+/// Keeps track of the timing of all the reads (and writes).
+class ReadStatistics {
+public:
+
+  /// A single timed read
+  class Read {
+  public:
+    /// The file read from
+    const DVDFileData * file;
+
+    /// The offset of the read within the file, in sectors
+    int offset;
+
+    /// The number of sectors requested
+    int blocks;
+
+    /// The number of sectors actually read, less than blocks for a
+    /// short read
+    int sectors;
+
+    /// Whether the read was successful or not
+    bool success;
+
+    /// The duration of the read, in microseconds
+    long usec;
+
+    Read(const DVDFileData * f, int o, int b, int n, bool s, long u) :
+      file(f), offset(o), blocks(b), sectors(n), success(s), usec(u) {;};
+  };
+
+  /// All the reads, in the order they were made.
+  std::vector<Read> reads;
+
+  /// Latency histograms, one for each titleset
+  std::map<int, LatencyHistogram> titlesets;
+
+  /// Sectors read and failed, for each titleset
+  std::map<int, TitlesetAmounts> amounts;
+
+  /// The phases, in the order in which they were started. The last
+  /// one is the current one.
+  std::vector<PhaseStatistics> phases;
+
+  /// The time at which the current phase started
+  long phaseStart;
+
+  /// If not NULL, every read is also appended to that log
+  std::unique_ptr<ReadLog> readLog;
+
+  ReadStatistics();
+
+  ~ReadStatistics();
+
+  /// Starts logging all the reads to the given file.
+  void setReadLog(const char * file);
+
+  /// Starts a new phase
+  void setPhase(const std::string & name);
+
+  /// Records a write call of @a sectors sectors that took @a usec
+  /// microseconds.
+  void recordWrite(int sectors, long usec);
+
+  /// Records a read of @a blocks sectors at @a offset in @a dat that
+  /// took @a usec microseconds. @a result is the number of sectors
+  /// read, or -1 if the read failed.
+  void recordRead(const DVDFileData * dat, int offset, int blocks,
+                  int result, long usec);
+
+  /// Adds the counters and histograms of @a other to this object,
+  /// all of its phases being accounted to the current phase. The
+  /// individual reads are not copied, as they refer to files that
+  /// belong to the other copy.
+  void merge(const ReadStatistics & other);
+
+  /// Prints out the p50/p99/max latencies for each titleset
+  void displayHistograms() const;
+
+  /// Prints out a summary of the run: amounts read per titleset,
+  /// time spent reading, failing, and writing in each phase, number
+  /// of calls and the largest stalls.
+  void displayReport();
+
+  /// Writes the same summary as displayReport, plus the latency
+  /// percentiles, in JSON format.
+  void writeJSONReport(const char * file);
+
+  /// Writes the JSON object of writeJSONReport to @a out
+  void writeJSON(FILE * out);
+
+  /// Writes the latency of every read to @a file, sorted by position
+  /// on the disc, in a gnuplot-friendly format.
+  ///
+  /// The @a files are used to position the files on the disc when
+  /// their start sector isn't known.
+  void writeLatencyMap(const char * file,
+                       const std::vector<DVDFileData *> & files) const;
+
+  /// Renders a heatmap of the disc surface as a PPM image: each
+  /// pixel represents a fixed number of consecutive sectors, from
+  /// blue (fast) to yellow (slow), red for read errors and black for
+  /// parts that weren't read at all.
+  void writeHeatmap(const char * file,
+                    const std::vector<DVDFileData *> & files) const;
+
+  /// Returns the current time of a monotonic clock, in microseconds.
+  static long timestamp();
+
+protected:
+
+  /// Returns the current phase, creating one if necessary
+  PhaseStatistics & currentPhase();
+
+  /// Updates the wall time of the current phase
+  void updateWallTime();
+
+  /// Returns the reads sorted by decreasing duration, at most @a nb
+  /// of them.
+  std::vector<const Read *> largestStalls(int nb) const;
+
+  /// Computes the position on the disc of the first sector of each
+  /// of the @a files, falling back to consecutive positions when the
+  /// start sector is unknown (ie when reading from a directory).
+  /// Returns the total number of sectors.
+  static long layout(const std::vector<DVDFileData *> & files,
+                     std::map<const DVDFileData *, long> & positions);
+};
+
+#endif
@@ -0,0 +1,237 @@
+/**
+    \file retryhistory.cc
+    Implementation of the RetryHistory class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "retryhistory.hh"
+#include "dvdcopy.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+bool RangeHistory::overlaps(const BadSectors & bs) const
+{
+  return bs.file->title == title && bs.file->domain == domain &&
+    bs.file->number == number &&
+    bs.start < start + count && start < bs.start + bs.number;
+}
+
+bool RangeHistory::failedOn(const std::string & device) const
+{
+  size_t start = 0;
+  while(start <= failedDrives.size()) {
+    size_t end = failedDrives.find(',', start);
+    if(end == std::string::npos)
+      end = failedDrives.size();
+    if(failedDrives.compare(start, end - start, device) == 0)
+      return true;
+    start = end + 1;
+  }
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+RetryHistory::RetryHistory(const std::string & file) : fileName(file)
+{
+  FILE * f = fopen(file.c_str(), "r");
+  if(! f)
+    return;                     // No retries yet
+  char buffer[4096];
+  while(fgets(buffer, sizeof(buffer), f)) {
+    if(buffer[0] == '#')
+      continue;
+    RangeHistory h;
+    char drive[4096], failed[4096];
+    drive[0] = 0;
+    failed[0] = 0;
+    // The failed drives are missing from the files of older versions
+    int nb = sscanf(buffer, "%d,%d,%d\t%d\t%d\t%d\t%d\t%d\t%ld\t%ld\t%ld\t"
+                    "%4095[^\t\n]\t%4095[^\n]",
+                    &h.title, &h.domain, &h.number, &h.start, &h.count,
+                    &h.attempts, &h.partial, &h.failures, &h.tried,
+                    &h.recovered, &h.time, drive, failed);
+    if(nb < 11)
+      continue;
+    h.drive = drive;
+    h.failedDrives = failed;
+    ranges.push_back(h);
+    addToIndex(ranges.size() - 1);
+  }
+  fclose(f);
+}
+
+void RetryHistory::addToIndex(int i)
+{
+  const RangeHistory & h = ranges[i];
+  std::array<int, 3> key = {{ h.title, h.domain, h.number }};
+  FileRanges & f = index[key];
+  std::pair<int, int> v(h.start, i);
+  f.starts.insert(std::upper_bound(f.starts.begin(), f.starts.end(), v), v);
+  f.maxCount = std::max(f.maxCount, h.count);
+}
+
+int RetryHistory::findIndex(const BadSectors & bs) const
+{
+  std::array<int, 3> key = {{ bs.file->title, bs.file->domain,
+                              bs.file->number }};
+  auto it = index.find(key);
+  if(it == index.end())
+    return -1;
+  const FileRanges & f = it->second;
+
+  // The exact range if it was tried, else the overlapping one tried
+  // the most, the oldest one first in both cases. Ranges starting
+  // maxCount sectors or more before bs can't overlap it.
+  int exact = -1, best = -1;
+  auto i = std::lower_bound(f.starts.begin(), f.starts.end(),
+                            std::make_pair(bs.start - f.maxCount + 1, -1));
+  for(; i != f.starts.end() && i->first < bs.start + bs.number; ++i) {
+    const RangeHistory & h = ranges[i->second];
+    if(! h.overlaps(bs))
+      continue;
+    if(h.start == bs.start && h.count == bs.number) {
+      if(exact < 0 || i->second < exact)
+        exact = i->second;
+    }
+    else if(best < 0 || h.attempts > ranges[best].attempts ||
+            (h.attempts == ranges[best].attempts && i->second < best))
+      best = i->second;
+  }
+  return exact >= 0 ? exact : best;
+}
+
+const RangeHistory * RetryHistory::find(const BadSectors & bs) const
+{
+  int i = findIndex(bs);
+  return i < 0 ? NULL : &ranges[i];
+}
+
+void RetryHistory::record(const BadSectors & bs, int recovered, long time,
+                          const std::string & drive)
+{
+  const RangeHistory * prev = find(bs);
+  RangeHistory * h;
+  if(prev && prev->start == bs.start && prev->count == bs.number)
+    h = const_cast<RangeHistory *>(prev);
+  else {
+    // A new range, which inherits from the one it comes from
+    RangeHistory n;
+    if(prev)
+      n = *prev;
+    n.title = bs.file->title;
+    n.domain = bs.file->domain;
+    n.number = bs.file->number;
+    n.start = bs.start;
+    n.count = bs.number;
+    ranges.push_back(n);
+    addToIndex(ranges.size() - 1);
+    h = &ranges.back();
+  }
+  h->attempts += 1;
+  h->tried += bs.number;
+  h->recovered += recovered;
+  h->time += time;
+  h->drive = drive;
+  if(recovered < bs.number && ! h->failedOn(drive)) {
+    if(! h->failedDrives.empty())
+      h->failedDrives += ",";
+    h->failedDrives += drive;
+  }
+  if(recovered == 0)
+    h->failures += 1;
+  else {
+    h->failures = 0;
+    if(recovered < bs.number)
+      h->partial += 1;
+  }
+}
+
+double RetryHistory::expectedYield(const BadSectors & bs) const
+{
+  const RangeHistory * h = find(bs);
+  // The fraction of sectors recovered so far, starting from 1/2 for
+  // ranges never tried.
+  double rate = h ? (h->recovered + 1.0)/(h->tried + 2.0) : 0.5;
+  // The time it takes to try a sector, 50ms if unknown
+  double sectorTime = (h && h->tried > 0 && h->time > 0) ?
+    h->time * 1e-6 / h->tried : 0.05;
+  return rate / sectorTime;
+}
+
+bool RetryHistory::givenUp(const BadSectors & bs, int maxFailures) const
+{
+  const RangeHistory * h = find(bs);
+  return maxFailures > 0 && h && h->failures >= maxFailures;
+}
+
+bool RetryHistory::failedOn(const BadSectors & bs,
+                            const std::string & drive) const
+{
+  const RangeHistory * h = find(bs);
+  return h && h->failedOn(drive);
+}
+
+void RetryHistory::save(const std::vector<BadSectors> & bad)
+{
+  // Keep only the ranges that are still relevant for a bad range
+  std::vector<bool> used(ranges.size(), false);
+  for(int j = 0; j < bad.size(); j++) {
+    int i = findIndex(bad[j]);
+    if(i >= 0)
+      used[i] = true;
+  }
+  std::vector<RangeHistory> kept;
+  for(int i = 0; i < ranges.size(); i++)
+    if(used[i])
+      kept.push_back(ranges[i]);
+  ranges = kept;
+  index.clear();
+  for(int i = 0; i < ranges.size(); i++)
+    addToIndex(i);
+
+  std::string tmp = fileName + ".tmp";
+  FILE * f = fopen(tmp.c_str(), "w");
+  if(! f) {
+    std::string err = "Could not write retry history '";
+    err += tmp;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  fprintf(f, "# dvdcopy retry history: title,domain,number, start, count, "
+          "attempts, partial, failures, tried, recovered, time (us), drive, "
+          "failed drives\n");
+  for(int i = 0; i < ranges.size(); i++) {
+    const RangeHistory & h = ranges[i];
+    fprintf(f, "%d,%d,%d\t%d\t%d\t%d\t%d\t%d\t%ld\t%ld\t%ld\t%s\t%s\n",
+            h.title, h.domain, h.number, h.start, h.count, h.attempts,
+            h.partial, h.failures, h.tried, h.recovered, h.time,
+            h.drive.c_str(), h.failedDrives.c_str());
+  }
+  fclose(f);
+  if(rename(tmp.c_str(), fileName.c_str())) {
+    std::string err = "Could not replace retry history '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+}
@@ -0,0 +1,135 @@
+/**
+    \file retryhistory.hh
+    The RetryHistory class, the outcome of the retries of bad sectors
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RETRYHISTORY_H
+#define __RETRYHISTORY_H
+
+class BadSectors;
+
+/// What happened so far to a range of bad sectors
+class RangeHistory {
+public:
+  /// The file, as the title, domain, number triplet of the bad
+  /// sectors file
+  int title, domain, number;
+
+  /// The range last tried
+  int start, count;
+
+  /// The number of times the range was tried, how many of them
+  /// recovered only part of it, and the number of consecutive ones
+  /// that recovered nothing
+  int attempts, partial, failures;
+
+  /// The number of sectors tried and recovered, over all the
+  /// attempts
+  long tried, recovered;
+
+  /// The time spent on the range, in microseconds
+  long time;
+
+  /// The drive used for the last attempt
+  std::string drive;
+
+  /// The drives that could not read (all of) the range, separated by
+  /// commas
+  std::string failedDrives;
+
+  RangeHistory() : title(0), domain(0), number(0), start(0), count(0),
+                   attempts(0), partial(0), failures(0), tried(0),
+                   recovered(0), time(0) {;};
+
+  /// Whether this concerns the same file as @a bs and overlaps it
+  bool overlaps(const BadSectors & bs) const;
+
+  /// Whether @a device is one of the failedDrives
+  bool failedOn(const std::string & device) const;
+};
+
+/// The history of the retries of bad sectors, kept next to the bad
+/// sectors file (with a .history suffix), across runs.
+///
+/// It is used to schedule the retries: ranges with the best expected
+/// yield (sectors recovered per second) are tried first, and those
+/// that failed too many times in a row are given up on.
+///
+/// When only part of a range is recovered, the rest inherits the
+/// history of the whole range.
+class RetryHistory {
+  /// The file
+  std::string fileName;
+
+  /// The ranges
+  std::vector<RangeHistory> ranges;
+
+  /// The ranges of a given file
+  class FileRanges {
+  public:
+    /// The start of the ranges and their index in ranges, sorted by
+    /// start
+    std::vector<std::pair<int, int> > starts;
+
+    /// The largest count of these ranges
+    int maxCount;
+
+    FileRanges() : maxCount(0) {;};
+  };
+
+  /// The ranges of each file, by title, domain and number
+  std::map<std::array<int, 3>, FileRanges> index;
+
+  /// Adds ranges[@a i] to the index
+  void addToIndex(int i);
+
+  /// The index in ranges of the history of @a bs (as returned by
+  /// find()), or -1.
+  int findIndex(const BadSectors & bs) const;
+
+public:
+
+  /// Loads the history from the given file, which need not exist.
+  RetryHistory(const std::string & file);
+
+  /// Returns the history of the range, or NULL if it was never
+  /// tried.
+  const RangeHistory * find(const BadSectors & bs) const;
+
+  /// Records an attempt on the range, which recovered @a recovered
+  /// sectors in @a time microseconds, from @a drive.
+  void record(const BadSectors & bs, int recovered, long time,
+              const std::string & drive);
+
+  /// The expected number of sectors recovered per second when trying
+  /// the range again.
+  double expectedYield(const BadSectors & bs) const;
+
+  /// Whether the range failed at least @a maxFailures times in a row
+  /// (never if @a maxFailures is 0 or less).
+  bool givenUp(const BadSectors & bs, int maxFailures) const;
+
+  /// Whether @a drive already tried the range, and left sectors
+  /// unread.
+  bool failedOn(const BadSectors & bs, const std::string & drive) const;
+
+  /// Forgets about the ranges that don't overlap any of @a bad (ie
+  /// those fully recovered), and writes the file.
+  void save(const std::vector<BadSectors> & bad);
+};
+
+#endif
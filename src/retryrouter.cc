@@ -0,0 +1,303 @@
+/**
+    \file retryrouter.cc
+    Implementation of the RetryRouter class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "retryrouter.hh"
+
+#include <stdio.h>
+
+#include <thread>
+
+RetryRouter::RetryRouter() : busyRanges(0), journal(NULL), maxFailures(3)
+{
+}
+
+void RetryRouter::addDrives(const char * list)
+{
+  std::string str = list;
+  size_t start = 0;
+  while(start <= str.size()) {
+    size_t end = str.find(',', start);
+    if(end == std::string::npos)
+      end = str.size();
+    if(end > start)
+      drives.push_back(std::unique_ptr<RetryDrive>
+                       (new RetryDrive(str.substr(start, end - start))));
+    start = end + 1;
+  }
+}
+
+void RetryRouter::addWorkers(const char * source, int nb)
+{
+  for(int i = 0; i < nb; i++)
+    drives.push_back(std::unique_ptr<RetryDrive>(new RetryDrive(source)));
+}
+
+bool RetryRouter::eligible(const Pending & p, const RetryDrive * drive) const
+{
+  return ! history->failedOn(p.range, drive->device) &&
+    ! history->givenUp(p.range, maxFailures);
+}
+
+void RetryRouter::addPending(const BadSectors & bs)
+{
+  int idx = pending.size();
+  double yield = history->expectedYield(bs);
+  pending.push_back(Pending(bs, yield));
+  for(int i = 0; i < drives.size(); i++)
+    drives[i]->queue.push(std::make_pair(yield, -idx));
+}
+
+std::vector<BadSectors> RetryRouter::stillMissing() const
+{
+  std::vector<BadSectors> ret;
+  for(int i = 0; i < pending.size(); i++)
+    if(! pending[i].done)
+      ret.push_back(pending[i].range);
+  return ret;
+}
+
+void RetryRouter::save()
+{
+  std::vector<BadSectors> remaining = outside;
+  std::vector<BadSectors> left = stillMissing();
+  remaining.insert(remaining.end(), left.begin(), left.end());
+  for(int i = 0; i < aliases.size(); i++)
+    remaining.push_back(aliases[i].range);
+
+  // This also removes the journal
+  drives[0]->copy->writeBadSectors(remaining);
+  history->save(remaining);
+}
+
+std::vector<BadSectors> RetryRouter::retryRange(RetryDrive * drive,
+                                                const BadSectors & bs)
+{
+  DVDCopy * copy = drive->copy.get();
+  int idx = copy->findFile(bs.file->title, bs.file->domain,
+                           bs.file->number);
+  if(idx < 0)
+    throw std::runtime_error("No file " + bs.file->fileName() +
+                             " on " + drive->device);
+  copy->badSectorsList.clear();
+  copy->copyFile(copy->files[idx], bs.start, bs.number,
+                 (copy->sectorsRead > 0 ? copy->sectorsRead : 16));
+
+  // Back to the files of the first drive
+  std::vector<BadSectors> still;
+  for(int i = 0; i < copy->badSectorsList.size(); i++) {
+    const BadSectors & b = copy->badSectorsList[i];
+    still.push_back(BadSectors(bs.file, b.start, b.number));
+  }
+  copy->badSectorsList.clear();
+  return still;
+}
+
+void RetryRouter::driveLoop(RetryDrive * drive)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    // The ranges done or not eligible leave the queue for good, as
+    // only trying them changes their history. Those other drives are
+    // working on go back to it, as they may come back.
+    int best = -1;
+    std::vector<std::pair<double, int> > busy;
+    while(! drive->queue.empty()) {
+      std::pair<double, int> top = drive->queue.top();
+      drive->queue.pop();
+      const Pending & p = pending[-top.second];
+      if(p.done || ! eligible(p, drive))
+        continue;
+      if(p.busy) {
+        busy.push_back(top);
+        continue;
+      }
+      best = -top.second;
+      break;
+    }
+    for(int i = 0; i < busy.size(); i++)
+      drive->queue.push(busy[i]);
+    if(best < 0) {
+      if(busyRanges == 0)
+        return;
+      rangeDone.wait(lock);
+      continue;
+    }
+
+    pending[best].busy = true;
+    busyRanges += 1;
+    BadSectors bs = pending[best].range;
+    printf("%s: trying to read %d bad sectors from file %s at %d\n",
+           drive->device.c_str(), bs.number, bs.file->fileName().c_str(),
+           bs.start);
+    lock.unlock();
+
+    std::vector<BadSectors> still;
+    std::string error;
+    long before = ReadStatistics::timestamp();
+    try {
+      still = retryRange(drive, bs);
+    }
+    catch(const std::exception & e) {
+      error = e.what();
+    }
+    long time = ReadStatistics::timestamp() - before;
+
+    lock.lock();
+    pending[best].busy = false;
+    busyRanges -= 1;
+    if(! error.empty()) {
+      // The range stays as it was, for the other drives
+      drive->error = error;
+      printf("%s: %s, done with that drive\n", drive->device.c_str(),
+             error.c_str());
+      rangeDone.notify_all();
+      return;
+    }
+    int nb = 0;
+    for(int i = 0; i < still.size(); i++)
+      nb += still[i].number;
+    history->record(bs, bs.number - nb, time, drive->device);
+    drive->ranges += 1;
+    drive->tried += bs.number;
+    drive->recovered += bs.number - nb;
+    drive->time += time;
+
+    fprintf(journal, "- %s\n", bs.toString().c_str());
+    for(int i = 0; i < still.size(); i++)
+      fprintf(journal, "+ %s\n", still[i].toString().c_str());
+    fflush(journal);
+
+    pending[best].done = true;
+    for(int i = 0; i < still.size(); i++)
+      addPending(still[i]);
+    if(nb > 0)
+      printf("%s: still got %d bad sectors (out of %d) in file %s at %d\n",
+             drive->device.c_str(), nb, bs.number,
+             bs.file->fileName().c_str(), bs.start);
+    else
+      printf("%s: read the %d sectors of file %s at %d\n",
+             drive->device.c_str(), bs.number,
+             bs.file->fileName().c_str(), bs.start);
+    rangeDone.notify_all();
+  }
+}
+
+long RetryRouter::run(const DVDCopy & settings, const char * target)
+{
+  // The same disc must be in all the drives
+  std::string fp;
+  output.reset(new OutputFiles(target));
+  std::vector<std::unique_ptr<RetryDrive> > usable;
+  for(int i = 0; i < drives.size(); i++) {
+    RetryDrive * d = drives[i].get();
+    std::unique_ptr<DVDCopy> copy(new DVDCopy(false));
+    copy->sectorsRead = settings.sectorsRead;
+    copy->retrying = true;
+    copy->journal = false;
+    copy->setOutputFiles(output.get());
+    try {
+      copy->setup(d->device.c_str(), target);
+      std::string f = copy->fingerprint();
+      if(fp.empty())
+        fp = f;
+      else if(f != fp) {
+        printf("The disc in %s is not the same as in %s, not using it\n",
+               d->device.c_str(), usable[0]->device.c_str());
+        continue;
+      }
+    }
+    catch(const std::exception & e) {
+      printf("Could not use %s: %s\n", d->device.c_str(), e.what());
+      continue;
+    }
+    d->copy = std::move(copy);
+    usable.push_back(std::move(drives[i]));
+  }
+  std::swap(drives, usable);
+  if(drives.empty())
+    throw std::runtime_error("No usable drive");
+
+  DVDCopy * first = drives[0]->copy.get();
+  first->badSectorsFileName = settings.badSectorsFileName;
+  first->readBadSectors();
+  first->closeBadSectorsFile();
+  first->parts = settings.parts;
+  first->selectBadSectors(first->badSectorsList, &outside);
+  first->aliasBadSectors(first->badSectorsList, &aliases);
+  history.reset(new RetryHistory(first->badSectorsFileName + ".history"));
+  maxFailures = settings.maxRetryFailures;
+
+  long total = 0;
+  for(int i = 0; i < first->badSectorsList.size(); i++) {
+    addPending(first->badSectorsList[i]);
+    total += first->badSectorsList[i].number;
+  }
+  first->badSectorsList.clear();
+
+  std::string journalName = first->badSectorsJournal();
+  journal = fopen(journalName.c_str(), "a");
+  if(! journal) {
+    std::string err = "Could not open the journal '";
+    err += journalName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+
+  printf("Retrying %ld bad sectors in %d ranges from %d drives\n",
+         total, (int) pending.size(), (int) drives.size());
+  std::vector<std::thread> threads;
+  for(int i = 0; i < drives.size(); i++)
+    threads.push_back(std::thread(&RetryRouter::driveLoop, this,
+                                  drives[i].get()));
+  for(int i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  fclose(journal);
+  journal = NULL;
+
+  if(! aliases.empty()) {
+    std::vector<BadSectors> bad = stillMissing();
+    first->resolveAliases(aliases, bad);
+    aliases.clear();
+    pending.clear();
+    for(int i = 0; i < bad.size(); i++)
+      pending.push_back(Pending(bad[i], 0));
+  }
+  save();
+
+  long missing = 0;
+  for(int i = 0; i < outside.size(); i++)
+    missing += outside[i].number;
+  for(int i = 0; i < pending.size(); i++)
+    if(! pending[i].done)
+      missing += pending[i].range.number;
+
+  printf("\nDrives report:\n");
+  for(int i = 0; i < drives.size(); i++) {
+    const RetryDrive * d = drives[i].get();
+    printf(" %s: %d ranges, recovered %ld sectors out of %ld, in %.1fs%s%s\n",
+           d->device.c_str(), d->ranges, d->recovered, d->tried,
+           d->time * 1e-6, d->error.empty() ? "" : ", stopped: ",
+           d->error.c_str());
+  }
+  printf("Altogether, there are still %ld missing sectors\n", missing);
+  return missing;
+}
@@ -0,0 +1,171 @@
+/**
+    \file retryrouter.hh
+    The RetryRouter class, to retry bad sectors on several drives
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RETRYROUTER_H
+#define __RETRYROUTER_H
+
+#include "dvdcopy.hh"
+#include "retryhistory.hh"
+#include "outputfiles.hh"
+
+#include <queue>
+#include <mutex>
+#include <condition_variable>
+
+/// One of the drives of a RetryRouter, and what it achieved
+class RetryDrive {
+public:
+  /// The device
+  std::string device;
+
+  /// The copy reading from that drive into the common target
+  std::unique_ptr<DVDCopy> copy;
+
+  /// The number of ranges tried
+  int ranges;
+
+  /// The number of sectors tried and recovered
+  long tried, recovered;
+
+  /// The time spent reading, in microseconds
+  long time;
+
+  /// The error that stopped the drive, if any
+  std::string error;
+
+  /// The pending ranges the drive may still try, as their expected
+  /// yield and minus their index in RetryRouter::pending: the best
+  /// yield comes first, and the oldest range among equal yields.
+  std::priority_queue<std::pair<double, int> > queue;
+
+  RetryDrive(const std::string & dev) :
+    device(dev), ranges(0), tried(0), recovered(0), time(0) {;};
+};
+
+/// Retries the bad sectors of a copy on several drives at the same
+/// time, holding the same disc (or identical ones), as different
+/// drive models often fail on different sectors.
+///
+/// Each drive runs in its own thread, and takes the range with the
+/// best expected yield among those it has not failed yet (as kept in
+/// the RetryHistory). What a drive could not read goes back to the
+/// others. The yield of a range doesn't change while it is pending,
+/// so that each drive keeps the ranges in a priority queue. A range is
+/// left alone once all the drives failed it, or once it failed too
+/// many times in a row.
+///
+/// The same works for several workers reading from a source that
+/// doesn't seek, such as an image (see addWorkers()).
+///
+/// All the drives write into the same target, through shared output
+/// files. The outcome of each range is appended to the journal of the
+/// bad sectors file, which is rewritten with the history only at the
+/// end.
+class RetryRouter {
+  /// A range still missing
+  class Pending {
+  public:
+    BadSectors range;
+    /// The expected yield, when the range was added
+    double yield;
+    /// Whether a drive is working on it
+    bool busy;
+    /// Whether a drive tried it, in which case what is still missing
+    /// was added as new ranges
+    bool done;
+    Pending(const BadSectors & bs, double y) :
+      range(bs), yield(y), busy(false), done(false) {;};
+  };
+
+  /// The drives
+  std::vector<std::unique_ptr<RetryDrive> > drives;
+
+  /// The ranges still missing (the ones not done), in terms of the
+  /// files of the first drive
+  std::vector<Pending> pending;
+
+  /// The number of ranges a drive is working on
+  int busyRanges;
+
+  /// The bad sectors outside of the selected parts, which are left as
+  /// they are (see DVDCopy::parts)
+  std::vector<BadSectors> outside;
+
+  /// The bad sectors that are the same on the disc as pending ones,
+  /// and are not tried themselves
+  std::vector<BadAlias> aliases;
+
+  /// The history of the retries
+  std::unique_ptr<RetryHistory> history;
+
+  /// The journal of the bad sectors file
+  FILE * journal;
+
+  /// The output files, shared by all the drives
+  std::unique_ptr<OutputFiles> output;
+
+  /// Gives up on ranges that failed that many times in a row
+  int maxFailures;
+
+  /// Protects everything above but the copies, and the terminal
+  std::mutex mutex;
+
+  /// Signalled when a drive is done with a range
+  std::condition_variable rangeDone;
+
+  /// Rewrites the bad sectors file and the history, once the drives
+  /// are done.
+  void save();
+
+  /// Whether @a drive should try the range
+  bool eligible(const Pending & p, const RetryDrive * drive) const;
+
+  /// Adds a range to try, to the queues of all the drives
+  void addPending(const BadSectors & bs);
+
+  /// The ranges not done yet
+  std::vector<BadSectors> stillMissing() const;
+
+  /// Reads the range again from the drive, and returns the ranges
+  /// still bad.
+  std::vector<BadSectors> retryRange(RetryDrive * drive,
+                                     const BadSectors & bs);
+
+  /// Takes ranges until there is none left for that drive.
+  void driveLoop(RetryDrive * drive);
+
+public:
+
+  RetryRouter();
+
+  /// Adds drives, given as a comma-separated list of devices.
+  void addDrives(const char * list);
+
+  /// Adds @a nb workers reading from @a source, which should not be a
+  /// drive.
+  void addWorkers(const char * source, int nb);
+
+  /// Retries the bad sectors of the copy in @a target. The number of
+  /// sectors read in one go, the bad sectors file, when to give up
+  /// and the parts of the titles to retry are taken from @a
+  /// settings. Returns the number of sectors still missing.
+  long run(const DVDCopy & settings, const char * target);
+};
+
+#endif
@@ -0,0 +1,190 @@
+/**
+    \file stages.hh
+    Stages processing the sectors read by DVDFile::walkFile()
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __STAGES_H
+#define __STAGES_H
+
+#include "dvdoutfile.hh"
+
+class DVDFileData;
+
+/// Receives the outcome of the reads done by DVDFile::walkFile().
+class ReadSink {
+public:
+  /// Called with the @a nb sectors read at @a offset in @a buffer
+  virtual void data(int offset, int nb, unsigned char * buffer,
+                    const DVDFileData * dat) = 0;
+
+  /// Called when the @a nb sectors at @a offset could not be read
+  virtual void error(int offset, int nb, const DVDFileData * dat) = 0;
+
+  virtual ~ReadSink() {;};
+};
+
+/// Runs several stages one after the other over each buffer read,
+/// while it is still hot in cache, so that adding a stage to a copy
+/// costs neither an extra pass over the disc nor an extra pass over
+/// memory.
+///
+/// A stage is any class with data() and error() functions with the
+/// same arguments as those of ReadSink, but not virtual: the stages
+/// are chained at compile time, so that only the call to the pipeline
+/// itself goes through a virtual function, once per read. Stages that
+/// are only used on some runs are wrapped in an OptionalStage.
+///
+/// The pipeline only keeps references to the stages, which must
+/// outlive it.
+template<typename... Stages> class Pipeline;
+
+/// The end of a pipeline
+template<> class Pipeline<> : public ReadSink {
+public:
+  virtual void data(int offset, int nb, unsigned char * buffer,
+                    const DVDFileData * dat) {;};
+
+  virtual void error(int offset, int nb, const DVDFileData * dat) {;};
+};
+
+template<typename First, typename... Rest>
+class Pipeline<First, Rest...> : public Pipeline<Rest...> {
+  First & first;
+public:
+  Pipeline(First & f, Rest &... rest) :
+    Pipeline<Rest...>(rest...), first(f) {;};
+
+  virtual void data(int offset, int nb, unsigned char * buffer,
+                    const DVDFileData * dat) {
+    first.data(offset, nb, buffer, dat);
+    Pipeline<Rest...>::data(offset, nb, buffer, dat);
+  };
+
+  virtual void error(int offset, int nb, const DVDFileData * dat) {
+    first.error(offset, nb, dat);
+    Pipeline<Rest...>::error(offset, nb, dat);
+  };
+};
+
+/// Makes a pipeline of the given stages
+template<typename... Stages>
+Pipeline<Stages...> pipeline(Stages &... stages)
+{
+  return Pipeline<Stages...>(stages...);
+}
+
+/// A stage that is only run if it was given, so that the set of
+/// stages can be chosen at run time.
+template<typename Stage> class OptionalStage {
+  Stage * stage;
+public:
+  /// Runs @a s, unless it is NULL.
+  OptionalStage(Stage * s) : stage(s) {;};
+
+  void data(int offset, int nb, unsigned char * buffer,
+            const DVDFileData * dat) {
+    if(stage)
+      stage->data(offset, nb, buffer, dat);
+  };
+
+  void error(int offset, int nb, const DVDFileData * dat) {
+    if(stage)
+      stage->error(offset, nb, dat);
+  };
+};
+
+/// A stage running the given functions, usually lambdas
+template<typename Data, typename Error> class FunctionStage {
+  Data onData;
+  Error onError;
+public:
+  FunctionStage(const Data & d, const Error & e) : onData(d), onError(e) {;};
+
+  void data(int offset, int nb, unsigned char * buffer,
+            const DVDFileData * dat) {
+    onData(offset, nb, buffer, dat);
+  };
+
+  void error(int offset, int nb, const DVDFileData * dat) {
+    onError(offset, nb, dat);
+  };
+};
+
+/// Makes a FunctionStage
+template<typename Data, typename Error>
+FunctionStage<Data, Error> functionStage(const Data & d, const Error & e)
+{
+  return FunctionStage<Data, Error>(d, e);
+}
+
+/// Writes the sectors read to an output file, and leaves holes for
+/// those that could not be read.
+class OutputStage {
+  DVDOutFile & out;
+public:
+  OutputStage(DVDOutFile & o) : out(o) {;};
+
+  void data(int offset, int nb, unsigned char * buffer,
+            const DVDFileData * dat) {
+    out.writeSectors(reinterpret_cast<char*>(buffer), nb);
+  };
+
+  void error(int offset, int nb, const DVDFileData * dat) {
+    out.skipSectors(nb);
+  };
+};
+
+/// Checks that the sectors read start with an MPEG pack header
+/// followed by a PES packet, as all the sectors of a VOB should, in
+/// front of the @a Next stage (usually a Pipeline): the sectors that
+/// do are passed on as data, and those that don't as errors, just as
+/// the read errors.
+template<typename Next> class PackCheckStage {
+  Next & next;
+
+  /// Whether the sector is a pack
+  static bool isPack(const unsigned char * sector) {
+    int first_pes_offset = 13 + (sector[13] & 0x7);
+    return sector[2] == 1 && sector[first_pes_offset + 3] == 1;
+  };
+
+public:
+  PackCheckStage(Next & n) : next(n) {;};
+
+  void data(int offset, int nb, unsigned char * buffer,
+            const DVDFileData * dat) {
+    // By runs of sectors that are packs or not
+    int i = 0;
+    while(i < nb) {
+      bool pack = isPack(buffer + i * 2048);
+      int j = i + 1;
+      while(j < nb && isPack(buffer + j * 2048) == pack)
+        j++;
+      if(pack)
+        next.data(offset + i, j - i, buffer + i * 2048, dat);
+      else
+        next.error(offset + i, j - i, dat);
+      i = j;
+    }
+  };
+
+  void error(int offset, int nb, const DVDFileData * dat) {
+    next.error(offset, nb, dat);
+  };
+};
+
+#endif
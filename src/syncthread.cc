@@ -0,0 +1,271 @@
+/**
+    \file syncthread.cc
+    Implementation of the SyncThread class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "syncthread.hh"
+#include "dvdreader.hh"
+#include "outputfiles.hh"
+#include "readstats.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+SyncThread::Policy SyncThread::parsePolicy(const char * name)
+{
+  std::string n = name;
+  if(n == "none")
+    return None;
+  if(n == "part")
+    return PerPart;
+  if(n == "periodic")
+    return Periodic;
+  if(n == "bad-range")
+    return PerBadRange;
+  std::string err = "Unknown durability policy: '";
+  err += name;
+  err += "' (should be none, part, periodic or bad-range)";
+  throw std::runtime_error(err);
+}
+
+/// Syncs the data of the given file, if it exists
+static void syncPath(const std::string & name)
+{
+  int fd = open(name.c_str(), O_RDONLY);
+  if(fd < 0)
+    return;
+  if(fdatasync(fd))
+    fprintf(stderr, "\nCould not sync '%s': %s\n", name.c_str(),
+            strerror(errno));
+  close(fd);
+}
+
+/// Whether the given directory is missing or holds no files
+static bool emptyDirectory(const std::string & name)
+{
+  DIR * dir = opendir(name.c_str());
+  if(! dir)
+    return true;
+  bool empty = true;
+  struct dirent * ent;
+  while(empty && (ent = readdir(dir)))
+    empty = ! strcmp(ent->d_name, ".") || ! strcmp(ent->d_name, "..");
+  closedir(dir);
+  return empty;
+}
+
+void SyncThread::syncDirectory(const std::string & file)
+{
+  std::string dir = ".";
+  size_t idx = file.rfind('/');
+  if(idx != std::string::npos)
+    dir = file.substr(0, idx + 1);
+  int fd = open(dir.c_str(), O_RDONLY);
+  if(fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+SyncThread::SyncThread(const std::string & t, Policy p, double i) :
+  target(t), stateFile(t + ".durable"), hadState(false),
+  requested(0), processed(0), stopping(false),
+  policy(p), interval(i), syncs(0), syncTime(0)
+{
+  FILE * f = fopen(stateFile.c_str(), "r");
+  if(f) {
+    hadState = true;
+    char buffer[1024];
+    while(fgets(buffer, sizeof(buffer), f)) {
+      if(buffer[0] == '#')
+        continue;
+      int title, domain, sectors;
+      if(sscanf(buffer, "%d\t%d\t%d", &title, &domain, &sectors) != 3)
+        continue;
+      std::array<int, 2> key = {{ title, domain }};
+      durable[key] = sectors;
+    }
+    fclose(f);
+  }
+  else if(emptyDirectory(target + "/VIDEO_TS")) {
+    // A new copy: nothing is on disc until the first checkpoint, even
+    // if the files are there after a crash.
+    saveState(durable);
+    hadState = true;
+  }
+  thread = std::thread(&SyncThread::loop, this);
+}
+
+SyncThread::~SyncThread()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void SyncThread::setBadSectorsSync(const std::function<void ()> & sync)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  syncBadSectors = sync;
+}
+
+void SyncThread::checkpoint(int title, dvd_read_domain_t domain, int sectors)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::array<int, 2> key = {{ title, (int) domain }};
+  std::map<std::array<int, 2>, int>::iterator i = pending.find(key);
+  if(i == pending.end())
+    pending[key] = sectors;
+  else if(i->second < sectors)
+    i->second = sectors;
+  requested += 1;
+  wake.notify_one();
+}
+
+void SyncThread::syncFile(int title, dvd_read_domain_t domain)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  std::array<int, 2> key = {{ title, (int) domain }};
+  if(pending.find(key) == pending.end())
+    pending[key] = -1;
+  long target = ++requested;
+  wake.notify_one();
+  while(processed < target)
+    done.wait(lock);
+}
+
+void SyncThread::flush()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  long target = requested;
+  while(processed < target)
+    done.wait(lock);
+}
+
+int SyncThread::durableSectors(int title, dvd_read_domain_t domain)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(! hadState)
+    return -1;
+  std::array<int, 2> key = {{ title, (int) domain }};
+  std::map<std::array<int, 2>, int>::iterator i = durable.find(key);
+  return i == durable.end() ? 0 : i->second;
+}
+
+void SyncThread::syncParts(int title, dvd_read_domain_t domain, int sectors)
+{
+  std::string dir = target + "/VIDEO_TS/";
+  if(domain != DVD_READ_TITLE_VOBS) {
+    syncPath(dir + DVDFileData::fileName(title, domain, 0));
+    return;
+  }
+  int last = sectors < 0 ? 9 : (sectors - 1) / OutputFiles::partSectors + 1;
+  for(int part = 1; part <= last; part++) {
+    std::string name = dir + DVDFileData::fileName(title, domain, part);
+    struct stat st;
+    if(stat(name.c_str(), &st))
+      break;
+    syncPath(name);
+  }
+}
+
+void SyncThread::saveState(const std::map<std::array<int, 2>, int> & state)
+{
+  std::string tmp = stateFile + ".tmp";
+  FILE * f = fopen(tmp.c_str(), "w");
+  if(! f) {
+    fprintf(stderr, "\nCould not write '%s': %s\n", tmp.c_str(),
+            strerror(errno));
+    return;
+  }
+  fprintf(f, "# dvdcopy durable sectors: title, domain, sectors\n");
+  for(std::map<std::array<int, 2>, int>::const_iterator i = state.begin();
+      i != state.end(); i++)
+    fprintf(f, "%d\t%d\t%d\n", i->first[0], i->first[1], i->second);
+  fflush(f);
+  fdatasync(fileno(f));
+  fclose(f);
+  if(rename(tmp.c_str(), stateFile.c_str())) {
+    fprintf(stderr, "\nCould not replace '%s': %s\n", stateFile.c_str(),
+            strerror(errno));
+    return;
+  }
+  // The rename itself must reach the disc
+  syncDirectory(stateFile);
+}
+
+void SyncThread::loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    if(pending.empty()) {
+      if(stopping)
+        return;
+      wake.wait(lock);
+      continue;
+    }
+    std::map<std::array<int, 2>, int> requests;
+    std::swap(requests, pending);
+    long nb = requested;
+    std::function<void ()> badSectors = syncBadSectors;
+    lock.unlock();
+
+    long before = ReadStatistics::timestamp();
+    // The bad sectors first: a checkpoint must never cover sectors
+    // that are neither on disc nor listed as bad.
+    if(badSectors)
+      badSectors();
+    bool checkpoints = false;
+    for(std::map<std::array<int, 2>, int>::iterator i = requests.begin();
+         i != requests.end(); i++) {
+      syncParts(i->first[0], (dvd_read_domain_t) i->first[1], i->second);
+      if(i->second >= 0)
+        checkpoints = true;
+    }
+
+    if(checkpoints) {
+      lock.lock();
+      for(std::map<std::array<int, 2>, int>::iterator i = requests.begin();
+          i != requests.end(); i++) {
+        if(i->second < 0)
+          continue;
+        int & d = durable[i->first];
+        if(i->second > d)
+          d = i->second;
+      }
+      hadState = true;
+      std::map<std::array<int, 2>, int> state = durable;
+      lock.unlock();
+      saveState(state);
+    }
+
+    lock.lock();
+    syncs += 1;
+    syncTime += ReadStatistics::timestamp() - before;
+    processed = nb;
+    done.notify_all();
+  }
+}
@@ -0,0 +1,158 @@
+/**
+    \file syncthread.hh
+    The SyncThread class, making the copy durable in the background
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SYNCTHREAD_H
+#define __SYNCTHREAD_H
+
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/// Makes the output of a copy durable from a background thread, so
+/// that the copy can be resumed correctly after a power loss.
+///
+/// After a crash of the system, the size of an output file says
+/// nothing of what reached the disc: the file may be shorter, or end
+/// with zeros, and the bad sectors file may lack the last ranges
+/// found. So the output files send checkpoints (see DVDOutFile):
+/// for each, the thread
+///  1. writes out the bad sectors and syncs the bad sectors file;
+///  2. syncs the parts of the output file up to the checkpoint;
+///  3. records the checkpoint in the target-directory.durable file,
+///     which is replaced atomically.
+///
+/// Resuming a copy only trusts the output files up to their last
+/// checkpoint (see durableSectors()). The reading thread waits for
+/// none of this, except that writes queued in a WriterPool must be
+/// written before a checkpoint is sent.
+class SyncThread {
+public:
+
+  /// When the output files send checkpoints
+  enum Policy {
+    /// Never: nothing is synced
+    None,
+    /// When a part of a title VOB is finished, and at the end of
+    /// each file
+    PerPart,
+    /// Every interval seconds, and at the end of each file
+    Periodic,
+    /// After each bad range, and at the end of each file
+    PerBadRange
+  };
+
+  /// Parses a policy name (none, part, periodic or bad-range)
+  static Policy parsePolicy(const char * name);
+
+  /// Syncs the directory containing @a file, so that its creation or
+  /// renaming reaches the disc.
+  static void syncDirectory(const std::string & file);
+
+private:
+
+  /// The target directory
+  std::string target;
+
+  /// The file where the checkpoints are recorded
+  std::string stateFile;
+
+  /// Whether the state file was there when starting, or was written
+  /// then for a new copy
+  bool hadState;
+
+  /// The durable number of sectors of the files, by title and domain
+  std::map<std::array<int, 2>, int> durable;
+
+  /// The checkpoints waiting to be processed, by title and domain; -1
+  /// to only sync the file (see syncFile())
+  std::map<std::array<int, 2>, int> pending;
+
+  /// The number of requests so far, and of those processed
+  long requested, processed;
+
+  /// Whether the thread must stop
+  bool stopping;
+
+  /// Writes out and syncs the bad sectors
+  std::function<void ()> syncBadSectors;
+
+  /// Protects all of the above
+  std::mutex mutex;
+
+  /// Wakes up the thread
+  std::condition_variable wake;
+
+  /// Signals that requests were processed
+  std::condition_variable done;
+
+  std::thread thread;
+
+  /// The body of the thread
+  void loop();
+
+  /// Syncs the parts of the given file up to @a sectors (all of
+  /// them if negative).
+  void syncParts(int title, dvd_read_domain_t domain, int sectors);
+
+  /// Rewrites the state file with the given durable sectors, and
+  /// syncs it
+  void saveState(const std::map<std::array<int, 2>, int> & state);
+
+public:
+
+  /// The policy
+  const Policy policy;
+
+  /// The interval between two checkpoints of the Periodic policy, in
+  /// seconds
+  const double interval;
+
+  /// The number of checkpoints processed, and the time spent syncing,
+  /// in microseconds
+  long syncs, syncTime;
+
+  /// Syncs the output of the copy to @a target. When starting a new
+  /// copy, writes an empty state file right away.
+  SyncThread(const std::string & target, Policy policy,
+             double interval = 30);
+
+  /// Sets the function that writes out and syncs the bad sectors,
+  /// called before each checkpoint.
+  void setBadSectorsSync(const std::function<void ()> & sync);
+
+  /// Records that the first @a sectors of the given file are
+  /// written, in the background.
+  void checkpoint(int title, dvd_read_domain_t domain, int sectors);
+
+  /// Syncs the given file, and waits until it is done.
+  void syncFile(int title, dvd_read_domain_t domain);
+
+  /// Waits until all the checkpoints sent so far are processed.
+  void flush();
+
+  /// The number of sectors of the given file that are known to be on
+  /// disc, or -1 if there is no information (no state file, and the
+  /// output was already there when the thread started).
+  int durableSectors(int title, dvd_read_domain_t domain);
+
+  /// Processes the pending checkpoints, and stops.
+  ~SyncThread();
+};
+
+#endif
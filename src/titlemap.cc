@@ -0,0 +1,304 @@
+/**
+    \file titlemap.cc
+    Implementation of the TitleMap class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "titlemap.hh"
+#include "ifocache.hh"
+#include "dvdreader.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+/// Parses a time, as seconds, mm:ss or hh:mm:ss
+static double parseTime(const std::string & str)
+{
+  double t = 0;
+  size_t start = 0;
+  while(true) {
+    size_t end = str.find(':', start);
+    t = t * 60 + atof(str.substr(start, end - start).c_str());
+    if(end == std::string::npos)
+      return t;
+    start = end + 1;
+  }
+}
+
+/// Splits title,rest and returns the title
+static int splitTitle(const char * spec, std::string * rest)
+{
+  std::string str = spec;
+  size_t idx = str.find(',');
+  int title = atoi(str.substr(0, idx).c_str());
+  if(title < 1) {
+    std::string err = "Invalid title in '";
+    err += spec;
+    err += "'";
+    throw std::runtime_error(err);
+  }
+  *rest = idx == std::string::npos ? std::string() : str.substr(idx + 1);
+  return title;
+}
+
+TitlePart TitlePart::chapters(const char * spec)
+{
+  TitlePart part;
+  std::string rest;
+  part.title = splitTitle(spec, &rest);
+  if(! rest.empty()) {
+    size_t idx = rest.find('-');
+    part.firstChapter = atoi(rest.substr(0, idx).c_str());
+    if(idx == std::string::npos)
+      part.lastChapter = part.firstChapter;
+    else
+      part.lastChapter = atoi(rest.substr(idx + 1).c_str());
+    if(part.firstChapter < 1 || part.lastChapter < 0 ||
+       (part.lastChapter > 0 && part.lastChapter < part.firstChapter)) {
+      std::string err = "Invalid chapters in '";
+      err += spec;
+      err += "'";
+      throw std::runtime_error(err);
+    }
+  }
+  return part;
+}
+
+TitlePart TitlePart::timeRange(const char * spec)
+{
+  TitlePart part;
+  part.byTime = true;
+  std::string rest;
+  part.title = splitTitle(spec, &rest);
+  size_t idx = rest.find('-');
+  if(idx == std::string::npos) {
+    std::string err = "Time range should be title,start-end, not '";
+    err += spec;
+    err += "'";
+    throw std::runtime_error(err);
+  }
+  part.from = parseTime(rest.substr(0, idx));
+  if(idx + 1 < rest.size())
+    part.to = parseTime(rest.substr(idx + 1));
+  return part;
+}
+
+std::string TitlePart::toString() const
+{
+  char buffer[100];
+  if(byTime) {
+    if(to < 0)
+      snprintf(buffer, sizeof(buffer), "title %d from %.0fs", title, from);
+    else
+      snprintf(buffer, sizeof(buffer), "title %d from %.0fs to %.0fs",
+               title, from, to);
+  }
+  else if(lastChapter == firstChapter)
+    snprintf(buffer, sizeof(buffer), "title %d, chapter %d",
+             title, firstChapter);
+  else if(lastChapter == 0)
+    snprintf(buffer, sizeof(buffer), "title %d, chapters %d to the end",
+             title, firstChapter);
+  else
+    snprintf(buffer, sizeof(buffer), "title %d, chapters %d-%d",
+             title, firstChapter, lastChapter);
+  return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// Information coming from:
+// http://dvd.sourceforge.net/dvdinfo/ifo.html
+
+/// Reads a big-endian number of @a bytes bytes at @a offset
+static unsigned readNumber(const std::vector<unsigned char> & data,
+                           size_t offset, int bytes)
+{
+  if(offset + bytes > data.size())
+    throw std::runtime_error("IFO file too short for its tables");
+  unsigned v = 0;
+  for(int i = 0; i < bytes; i++)
+    v = v << 8 | data[offset + i];
+  return v;
+}
+
+/// Decodes the BCD playback time at @a offset, in seconds
+static double playbackTime(const std::vector<unsigned char> & data,
+                           size_t offset)
+{
+  unsigned t = readNumber(data, offset, 4);
+  unsigned char b[4] = { (unsigned char) (t >> 24),
+                         (unsigned char) (t >> 16),
+                         (unsigned char) (t >> 8),
+                         (unsigned char) t };
+  int frames = ((b[3] >> 4) & 0x3) * 10 + (b[3] & 0xf);
+  double fps = (b[3] >> 6) == 1 ? 25 : 30;
+  return ((b[0] >> 4) * 10 + (b[0] & 0xf)) * 3600 +
+    ((b[1] >> 4) * 10 + (b[1] & 0xf)) * 60 +
+    ((b[2] >> 4) * 10 + (b[2] & 0xf)) + frames / fps;
+}
+
+TitleMap::TitleMap(IFOCache * c, const std::vector<DVDFileData *> & f) :
+  cache(c), files(f)
+{
+}
+
+bool TitleMap::load(int titleSet, dvd_read_domain_t domain,
+                    std::vector<unsigned char> * data)
+{
+  for(int i = 0; i < files.size(); i++) {
+    const DVDFileData * dat = files[i];
+    if(dat->title != titleSet || dat->domain != domain)
+      continue;
+    int size = cache->fileSize(dat);
+    if(size <= 0)
+      return false;
+    data->assign(size * 2048, 0);
+    return cache->readBlocks(dat, 0, size, &(*data)[0]) == size;
+  }
+  return false;
+}
+
+const std::vector<unsigned char> & TitleMap::ifo(int titleSet)
+{
+  std::map<int, std::vector<unsigned char> >::iterator i =
+    ifos.find(titleSet);
+  if(i != ifos.end())
+    return i->second;
+
+  std::vector<unsigned char> & data = ifos[titleSet];
+  if(! load(titleSet, DVD_READ_INFO_FILE, &data)) {
+    std::vector<unsigned char> bup;
+    if(load(titleSet, DVD_READ_INFO_BACKUP_FILE, &bup))
+      std::swap(data, bup);
+    else if(data.empty()) {
+      char buffer[100];
+      snprintf(buffer, sizeof(buffer), "Could not read the IFO of "
+               "title set %d", titleSet);
+      throw std::runtime_error(buffer);
+    }
+    // Else, make do with what could be read
+  }
+  return data;
+}
+
+/// A cell of a title
+class TitleCell {
+public:
+  /// The chapter it belongs to
+  int chapter;
+
+  /// When it starts in the title, and its duration, in seconds
+  double start, duration;
+
+  /// The first and the last sector
+  int first, last;
+};
+
+std::vector<VOBRange> TitleMap::sectors(const TitlePart & part)
+{
+  // The title in the title table of VIDEO_TS.IFO
+  const std::vector<unsigned char> & vmg = ifo(0);
+  size_t ttSrpt = readNumber(vmg, 0xC4, 4) * 2048;
+  int titles = readNumber(vmg, ttSrpt, 2);
+  if(part.title > titles) {
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "No title %d on the disc (only %d)",
+             part.title, titles);
+    throw std::runtime_error(buffer);
+  }
+  size_t entry = ttSrpt + 8 + 12 * (part.title - 1);
+  int titleSet = readNumber(vmg, entry + 6, 1);
+  int vtsTitle = readNumber(vmg, entry + 7, 1);
+
+  // Its chapters, in the chapter table of the title set
+  const std::vector<unsigned char> & vts = ifo(titleSet);
+  size_t pttSrpt = readNumber(vts, 0xC8, 4) * 2048;
+  int vtsTitles = readNumber(vts, pttSrpt, 2);
+  if(vtsTitle < 1 || vtsTitle > vtsTitles)
+    throw std::runtime_error("Inconsistent title tables in the IFO files");
+  size_t ptt = pttSrpt + readNumber(vts, pttSrpt + 8 + 4 * (vtsTitle - 1), 4);
+  size_t pttEnd = pttSrpt + (vtsTitle < vtsTitles ?
+                             readNumber(vts, pttSrpt + 8 + 4 * vtsTitle, 4) :
+                             readNumber(vts, pttSrpt + 4, 4) + 1);
+  int chapters = (pttEnd - ptt) / 4;
+
+  // The cells of each chapter, from the program chains
+  size_t pgci = readNumber(vts, 0xCC, 4) * 2048;
+  std::vector<TitleCell> cells;
+  double time = 0;
+  for(int c = 0; c < chapters; c++) {
+    int pgcn = readNumber(vts, ptt + 4 * c, 2);
+    int pgn = readNumber(vts, ptt + 4 * c + 2, 2);
+    size_t pgc = pgci + readNumber(vts, pgci + 8 + 8 * (pgcn - 1) + 4, 4);
+    int programs = readNumber(vts, pgc + 2, 1);
+    int nbCells = readNumber(vts, pgc + 3, 1);
+    size_t programMap = pgc + readNumber(vts, pgc + 0xE6, 2);
+    size_t playback = pgc + readNumber(vts, pgc + 0xE8, 2);
+    if(pgn < 1 || pgn > programs)
+      throw std::runtime_error("Inconsistent chapter table in the IFO files");
+    int firstCell = readNumber(vts, programMap + pgn - 1, 1);
+    int lastCell = pgn < programs ?
+      readNumber(vts, programMap + pgn, 1) - 1 : nbCells;
+    for(int k = firstCell; k <= lastCell; k++) {
+      size_t cell = playback + 24 * (k - 1);
+      TitleCell tc;
+      tc.chapter = c + 1;
+      tc.start = time;
+      tc.duration = playbackTime(vts, cell + 4);
+      tc.first = readNumber(vts, cell + 8, 4);
+      tc.last = readNumber(vts, cell + 20, 4);
+      time += tc.duration;
+      cells.push_back(tc);
+    }
+  }
+
+  if(! part.byTime && part.firstChapter > chapters) {
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "No chapter %d in title %d (only %d)",
+             part.firstChapter, part.title, chapters);
+    throw std::runtime_error(buffer);
+  }
+
+  std::vector<std::pair<int, int> > selected;
+  for(int i = 0; i < cells.size(); i++) {
+    const TitleCell & tc = cells[i];
+    bool in;
+    if(part.byTime)
+      in = tc.start + tc.duration > part.from &&
+        (part.to < 0 || tc.start < part.to);
+    else
+      in = tc.chapter >= part.firstChapter &&
+        (part.lastChapter == 0 || tc.chapter <= part.lastChapter);
+    if(in && tc.last >= tc.first)
+      selected.push_back(std::make_pair(tc.first, tc.last + 1));
+  }
+
+  // Cells may be shared between angles, or played several times
+  std::sort(selected.begin(), selected.end());
+  std::vector<VOBRange> ret;
+  for(int i = 0; i < selected.size(); i++) {
+    if(! ret.empty() && selected[i].first <= ret.back().end)
+      ret.back().end = std::max(ret.back().end, selected[i].second);
+    else
+      ret.push_back(VOBRange(titleSet, selected[i].first,
+                             selected[i].second));
+  }
+  return ret;
+}
@@ -0,0 +1,106 @@
+/**
+    \file titlemap.hh
+    The TitleMap class, from titles and chapters to sectors
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TITLEMAP_H
+#define __TITLEMAP_H
+
+class IFOCache;
+class DVDFileData;
+
+/// A part of a title: a range of chapters, or a time range from the
+/// start of the title.
+class TitlePart {
+public:
+  /// The title, as numbered on the disc, starting from 1
+  int title;
+
+  /// Whether the part is a time range rather than chapters
+  bool byTime;
+
+  /// The chapters, starting from 1, both included. The last one is 0
+  /// for the end of the title.
+  int firstChapter, lastChapter;
+
+  /// The time range, in seconds. The end is negative for the end of
+  /// the title.
+  double from, to;
+
+  TitlePart() : title(1), byTime(false), firstChapter(1), lastChapter(0),
+                from(0), to(-1) {;};
+
+  /// Parses title[,chapter[-chapter]]
+  static TitlePart chapters(const char * spec);
+
+  /// Parses title,start-end, where the times are seconds, mm:ss or
+  /// hh:mm:ss, and either one can be omitted.
+  static TitlePart timeRange(const char * spec);
+
+  /// A description of the part, for the messages
+  std::string toString() const;
+};
+
+/// A range of sectors in the title VOBs of a title set (as numbered
+/// in the cells, ie from the start of VTS_xx_1.VOB)
+class VOBRange {
+public:
+  /// The title set
+  int titleSet;
+
+  /// The first sector, and the one after the last
+  int start, end;
+
+  VOBRange(int ts, int s, int e) : titleSet(ts), start(s), end(e) {;};
+};
+
+/// Maps the titles, chapters and playback times to the sectors of the
+/// title VOBs, using the title table of VIDEO_TS.IFO and the chapter
+/// and cell tables of the title set IFOs.
+///
+/// The IFO files come from the IFOCache, falling back to the BUP
+/// files when they can't be read fully. Time ranges are rounded to
+/// whole cells.
+class TitleMap {
+  /// The IFO files
+  IFOCache * cache;
+
+  /// The files of the source
+  const std::vector<DVDFileData *> & files;
+
+  /// The contents of the IFO files, by title set (0 for VIDEO_TS)
+  std::map<int, std::vector<unsigned char> > ifos;
+
+  /// Returns the contents of the IFO of the given title set, loading
+  /// it if needed.
+  const std::vector<unsigned char> & ifo(int titleSet);
+
+  /// Loads the given file through the cache. Returns false if it
+  /// doesn't exist or can't be read fully.
+  bool load(int titleSet, dvd_read_domain_t domain,
+            std::vector<unsigned char> * data);
+
+public:
+
+  TitleMap(IFOCache * cache, const std::vector<DVDFileData *> & files);
+
+  /// The sectors of the part of the title, sorted and merged. Throws
+  /// an exception if the title or the chapters don't exist.
+  std::vector<VOBRange> sectors(const TitlePart & part);
+};
+
+#endif
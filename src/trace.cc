@@ -0,0 +1,159 @@
+/**
+    \file trace.cc
+    Implementation of the tracing facilities
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "trace.hh"
+
+#include <stdio.h>
+
+#ifndef DVDCOPY_TRACE
+
+void Trace::setOutput(const char * file)
+{
+  fprintf(stderr, "Tracing support was not compiled in, "
+          "configure with CPPFLAGS=-DDVDCOPY_TRACE\n");
+}
+
+#else
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+
+/// The ring buffer of a single thread.
+class TraceBuffer {
+public:
+  /// Number of spans kept for each thread
+  static const unsigned long size = 1 << 16;
+
+  class Span {
+  public:
+    const char * name;
+    long start;
+    long end;
+  };
+
+  Span spans[size];
+
+  /// The total number of spans recorded so far. Only the writing
+  /// thread modifies it.
+  std::atomic<unsigned long> head;
+
+  /// The thread number
+  int tid;
+
+  TraceBuffer(int t) : head(0), tid(t) {;};
+};
+
+/// All the buffers ever created. They are never freed, so that the
+/// spans of threads that are finished can still be written out.
+static std::vector<TraceBuffer *> buffers;
+
+/// Protects buffers, only used when a thread records its first span
+static std::mutex buffersMutex;
+
+static thread_local TraceBuffer * threadBuffer = NULL;
+
+static std::string outputFile;
+
+bool Trace::enabled = false;
+
+long Trace::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void Trace::record(const char * name, long start, long end)
+{
+  TraceBuffer * buf = threadBuffer;
+  if(! buf) {
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    buf = new TraceBuffer(buffers.size() + 1);
+    buffers.push_back(buf);
+    threadBuffer = buf;
+  }
+  unsigned long h = buf->head.load(std::memory_order_relaxed);
+  TraceBuffer::Span & s = buf->spans[h % TraceBuffer::size];
+  s.name = name;
+  s.start = start;
+  s.end = end;
+  buf->head.store(h + 1, std::memory_order_release);
+}
+
+static void writeTrace()
+{
+  Trace::write();
+}
+
+void Trace::setOutput(const char * file)
+{
+  if(! enabled)
+    atexit(&writeTrace);
+  outputFile = file;
+  enabled = true;
+}
+
+void Trace::write()
+{
+  if(outputFile.empty())
+    return;
+  FILE * out = fopen(outputFile.c_str(), "w");
+  if(! out) {
+    fprintf(stderr, "Could not write trace to '%s': %s\n",
+            outputFile.c_str(), strerror(errno));
+    return;
+  }
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  long origin = -1;
+  for(int i = 0; i < buffers.size(); i++) {
+    TraceBuffer * buf = buffers[i];
+    unsigned long h = buf->head.load(std::memory_order_acquire);
+    unsigned long first = (h > TraceBuffer::size ? h - TraceBuffer::size : 0);
+    if(h > first && (origin < 0 ||
+                     buf->spans[first % TraceBuffer::size].start < origin))
+      origin = buf->spans[first % TraceBuffer::size].start;
+  }
+
+  fprintf(out, "{\"traceEvents\":[\n");
+  bool firstEvent = true;
+  int pid = getpid();
+  for(int i = 0; i < buffers.size(); i++) {
+    TraceBuffer * buf = buffers[i];
+    unsigned long h = buf->head.load(std::memory_order_acquire);
+    unsigned long first = (h > TraceBuffer::size ? h - TraceBuffer::size : 0);
+    for(unsigned long j = first; j < h; j++) {
+      const TraceBuffer::Span & s = buf->spans[j % TraceBuffer::size];
+      fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f}",
+              firstEvent ? "" : ",\n", s.name, pid, buf->tid,
+              (s.start - origin) * 1e-3, (s.end - s.start) * 1e-3);
+      firstEvent = false;
+    }
+  }
+  fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  fclose(out);
+  fprintf(stderr, "Trace written to '%s'\n", outputFile.c_str());
+}
+
+#endif
@@ -0,0 +1,85 @@
+/**
+    \file trace.hh
+    Low-overhead tracing of the hot paths
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TRACE_H
+#define __TRACE_H
+
+/// Tracing of the time spent in the hot paths, exported in the
+/// Chrome trace event format (that can be loaded in
+/// chrome://tracing or https://ui.perfetto.dev).
+///
+/// Tracing is only compiled in when DVDCOPY_TRACE is defined
+/// (configure with CPPFLAGS=-DDVDCOPY_TRACE). Otherwise, TRACE_SPAN
+/// expands to nothing.
+///
+/// Each thread records its spans in its own fixed-size ring buffer,
+/// without any locking; the oldest spans are overwritten when the
+/// buffer is full. The buffers are written out at exit.
+class Trace {
+public:
+
+  /// Sets the file in which the trace is written at exit, and
+  /// enables the recording.
+  static void setOutput(const char * file);
+
+#ifdef DVDCOPY_TRACE
+  /// Whether spans are being recorded
+  static bool enabled;
+
+  /// Records a span named @a name between @a start and @a end
+  /// (nanoseconds of the monotonic clock).
+  static void record(const char * name, long start, long end);
+
+  /// The current time, in nanoseconds
+  static long now();
+
+  /// Writes the trace out.
+  static void write();
+#endif
+};
+
+#ifdef DVDCOPY_TRACE
+
+/// Records the time between its creation and its destruction.
+class TraceSpan {
+  const char * name;
+  long start;
+public:
+  TraceSpan(const char * n) : name(n),
+                              start(Trace::enabled ? Trace::now() : 0) {;};
+  ~TraceSpan() {
+    if(Trace::enabled)
+      Trace::record(name, start, Trace::now());
+  };
+};
+
+#define TRACE_CONCAT2(a, b) a ## b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+
+/// Traces the rest of the current scope under the given name, which
+/// must be a string literal.
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name) do {} while(0)
+
+#endif
+
+#endif
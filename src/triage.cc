@@ -0,0 +1,385 @@
+/**
+    \file triage.cc
+    Implementation of the Triage class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "triage.hh"
+#include "dvdreader.hh"
+#include "dvdfile.hh"
+#include "readstats.hh"
+#include "progress.hh"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+/// The number of sectors of each read
+#define SAMPLE_SECTORS 16
+
+/// The number of zones the disc is cut into
+#define ZONES 200
+
+/// The maximum number of samples per zone
+#define MAX_ROUNDS 16
+
+double TriageZone::badFraction() const
+{
+  return samples > 0 ? failures * 1.0 / samples : 0;
+}
+
+double TriageZone::averageTime() const
+{
+  return samples > 0 ? sampleTime * 1.0 / samples : 0;
+}
+
+/// The position of the n-th sample within a zone, as a fraction of
+/// its size: 1/2, 1/4, 3/4, 1/8... so that any number of rounds
+/// spreads the samples evenly.
+static double samplePosition(int n)
+{
+  double pos = 0, scale = 0.5;
+  for(n += 1; n > 0; n >>= 1, scale *= 0.5)
+    if(n & 1)
+      pos += scale;
+  return pos;
+}
+
+/// Formats a duration in seconds as h:mm:ss
+static std::string formatDuration(double seconds)
+{
+  char buffer[50];
+  long s = (long) seconds;
+  snprintf(buffer, sizeof(buffer), "%ld:%02ld:%02ld",
+           s / 3600, (s / 60) % 60, s % 60);
+  return buffer;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+Triage::Triage() : totalSectors(0), readStart(0), finished(false),
+                   stuck(false), budget(60), stuckTime(30)
+{
+}
+
+void Triage::watchdog()
+{
+  while(! finished) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    long start = readStart;
+    if(start && ReadStatistics::timestamp() - start > stuckTime * 1e6) {
+      // Held until the end: the sampling thread must not touch the
+      // zones anymore, should the read return after all.
+      mutex.lock();
+      stuck = true;
+      printf("\nA read has been blocked for more than %.0f seconds, "
+             "giving up\n", stuckTime);
+      // An exception escaping the thread would terminate the program
+      // without the verdict.
+      try {
+        displayReport();
+        if(! reportFile.empty())
+          writeJSONReport(reportFile.c_str());
+      }
+      catch(const std::exception & e) {
+        fprintf(stderr, "\n%s\n", e.what());
+      }
+      fflush(stdout);
+      _exit(Hopeless);
+    }
+  }
+}
+
+Triage::Verdict Triage::run(const char * source)
+{
+  DVDReader reader(source);
+  {
+    std::vector<DVDFileData *> lst = reader.listFiles();
+    for(int i = 0; i < lst.size(); i++)
+      files.push_back(std::unique_ptr<DVDFileData>(lst[i]));
+  }
+
+  // Only the VOB files, the title ones as a whole
+  std::vector<std::unique_ptr<DVDFile> > vobs;
+  for(int i = 0; i < files.size(); i++) {
+    const DVDFileData * dat = files[i].get();
+    if(dat->isIFO() || dat->dup || dat->number > 1)
+      continue;
+    DVDFile * file = DVDFile::openFile(reader.handle(), dat);
+    if(! file)
+      continue;
+    vobs.push_back(std::unique_ptr<DVDFile>(file));
+    totalSectors += file->fileSize();
+  }
+  if(totalSectors == 0)
+    throw std::runtime_error("No VOB files to sample");
+
+  // Zones in proportion of the size, at least one per file
+  for(int i = 0; i < vobs.size(); i++) {
+    int size = vobs[i]->fileSize();
+    int nb = std::max(1L, ZONES * (long) size / totalSectors);
+    nb = std::max(1, std::min(nb, size / (2 * SAMPLE_SECTORS)));
+    for(int j = 0; j < nb; j++) {
+      int start = (long) size * j / nb;
+      int end = (long) size * (j + 1) / nb;
+      zones.push_back(TriageZone(vobs[i]->fileData(), start, end - start));
+    }
+  }
+
+  printf("Sampling %s: %d zones, %ld sectors, for at most %.0f seconds\n",
+         source, (int) zones.size(), totalSectors, budget);
+  std::thread dog(&Triage::watchdog, this);
+
+  std::unique_ptr<unsigned char[]> buffer(new unsigned char[SAMPLE_SECTORS * 2048]);
+  long startTime = ReadStatistics::timestamp();
+  int samples = 0;
+  for(int round = 0; round < MAX_ROUNDS; round++) {
+    int z = 0;
+    for(int i = 0; i < vobs.size(); i++) {
+      DVDFile * file = vobs[i].get();
+      const DVDFileData * dat = file->fileData();
+      int fileSize = file->fileSize();
+      for(; z < zones.size() && zones[z].file == dat; z++) {
+        if(ReadStatistics::timestamp() - startTime > budget * 1e6)
+          break;
+        TriageZone & zone = zones[z];
+
+        // On an ECC block boundary, when the position on the disc is
+        // known
+        int pos = zone.start + (int) (samplePosition(round) * zone.size);
+        if(dat->startSector >= 0)
+          pos -= (dat->startSector + pos) % SAMPLE_SECTORS;
+        pos = std::max(0, std::min(pos, fileSize - 2 * SAMPLE_SECTORS));
+        int nb = std::min(SAMPLE_SECTORS, fileSize - pos);
+
+        readStart = ReadStatistics::timestamp();
+        int read = file->readBlocks(pos, nb, buffer.get());
+        long duration = ReadStatistics::timestamp() - readStart;
+        bool failed = read < nb;
+        bool streamed = false;
+        long streamDuration = 0;
+        if(! failed && pos + 2 * nb <= fileSize) {
+          // No seek needed for that one: that is the reading speed
+          readStart = ReadStatistics::timestamp();
+          read = file->readBlocks(pos + nb, nb, buffer.get());
+          streamDuration = ReadStatistics::timestamp() - readStart;
+          streamed = read == nb;
+        }
+        readStart = 0;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        zone.samples += 1;
+        zone.sampleTime += duration;
+        if(failed) {
+          zone.failures += 1;
+          zone.failureTime += duration;
+        }
+        else if(streamed) {
+          zone.streamReads += 1;
+          zone.streamTime += streamDuration;
+        }
+        samples++;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      printf("\rRound %d: %d samples, %.1f s", round + 1, samples,
+             (ReadStatistics::timestamp() - startTime) * 1e-6);
+      fflush(stdout);
+    }
+    if(ReadStatistics::timestamp() - startTime > budget * 1e6)
+      break;
+  }
+  printf("\n");
+  finished = true;
+  dog.join();
+
+  displayReport();
+  if(! reportFile.empty()) {
+    printf("Writing triage report to '%s'\n", reportFile.c_str());
+    writeJSONReport(reportFile.c_str());
+  }
+
+  double bad, time;
+  estimates(&bad, &time);
+  const char * v = verdict(bad, time);
+  if(! strcmp(v, "pristine"))
+    return Pristine;
+  if(! strcmp(v, "damaged"))
+    return Damaged;
+  return Hopeless;
+}
+
+void Triage::estimates(double * badFraction, double * copyTime) const
+{
+  // Averages over the whole disc, for the zones that lack samples
+  long streamReads = 0, streamTime = 0, failures = 0, failureTime = 0;
+  long samples = 0;
+  for(int i = 0; i < zones.size(); i++) {
+    streamReads += zones[i].streamReads;
+    streamTime += zones[i].streamTime;
+    failures += zones[i].failures;
+    failureTime += zones[i].failureTime;
+    samples += zones[i].samples;
+  }
+  double sectorTime = streamReads > 0 ?
+    streamTime * 1.0 / (streamReads * SAMPLE_SECTORS) : 0;
+  double failTime = failures > 0 ? failureTime * 1.0 / failures : 0;
+  double defaultBad = samples > 0 ? failures * 1.0 / samples : 0;
+
+  double bad = 0, time = 0;
+  for(int i = 0; i < zones.size(); i++) {
+    const TriageZone & z = zones[i];
+    double bf = z.samples > 0 ? z.badFraction() : defaultBad;
+    double st = z.streamReads > 0 ?
+      z.streamTime * 1.0 / (z.streamReads * SAMPLE_SECTORS) : sectorTime;
+    bad += bf * z.size;
+    // Bad areas are read again by ECC blocks
+    time += z.size * ((1 - bf) * st + bf * failTime / SAMPLE_SECTORS);
+  }
+  *badFraction = totalSectors > 0 ? bad / totalSectors : 0;
+  *copyTime = time * 1e-6;
+}
+
+std::vector<TriageZone> Triage::slowZones() const
+{
+  std::vector<double> times;
+  for(int i = 0; i < zones.size(); i++)
+    if(zones[i].samples > zones[i].failures)
+      times.push_back((zones[i].sampleTime - zones[i].failureTime) * 1.0/
+                      (zones[i].samples - zones[i].failures));
+  double limit = 0;
+  if(! times.empty()) {
+    std::sort(times.begin(), times.end());
+    // Well above the typical time, and not just by a few
+    // milliseconds
+    limit = 4 * times[times.size()/2] + 20000;
+  }
+
+  std::vector<TriageZone> ret;
+  bool last = false;
+  for(int i = 0; i < zones.size(); i++) {
+    const TriageZone & z = zones[i];
+    bool slow = z.samples > 0 &&
+      (z.failures > 0 || times.empty() || z.averageTime() > limit);
+    if(! slow) {
+      last = false;
+      continue;
+    }
+    if(last && ret.back().file == z.file) {
+      // Merge with the previous one
+      TriageZone & p = ret.back();
+      p.size += z.size;
+      p.samples += z.samples;
+      p.failures += z.failures;
+      p.sampleTime += z.sampleTime;
+      p.failureTime += z.failureTime;
+      p.streamReads += z.streamReads;
+      p.streamTime += z.streamTime;
+    }
+    else
+      ret.push_back(z);
+    last = true;
+  }
+  return ret;
+}
+
+const char * Triage::verdict(double badFraction, double copyTime) const
+{
+  if(stuck || badFraction > 0.02 || copyTime > 3 * 3600)
+    return "hopeless";
+  if(badFraction > 0 || ! slowZones().empty())
+    return "damaged";
+  return "pristine";
+}
+
+/// What to do with a disc, depending on the verdict
+static const char * strategy(const char * verdict)
+{
+  if(! strcmp(verdict, "pristine"))
+    return "copy normally";
+  if(! strcmp(verdict, "damaged"))
+    return "copy, then run a second pass";
+  return "copy last, or try another drive";
+}
+
+void Triage::displayReport()
+{
+  long samples = 0;
+  for(int i = 0; i < zones.size(); i++)
+    samples += zones[i].samples;
+  double bad, time;
+  estimates(&bad, &time);
+  printf("\nTriage report: %ld samples in %d zones\n", samples,
+         (int) zones.size());
+  printf(" estimated bad sectors: %.2f%% (about %.0f sectors)\n",
+         bad * 100, bad * totalSectors);
+  printf(" estimated copy time: %s\n", formatDuration(time).c_str());
+
+  std::vector<TriageZone> slow = slowZones();
+  if(! slow.empty()) {
+    printf(" slow or damaged zones:\n");
+    for(int i = 0; i < slow.size(); i++) {
+      const TriageZone * z = &slow[i];
+      printf("   %s, sectors %d-%d: %d/%d samples failed, "
+             "%.0f ms per sample\n",
+             z->file->fileName(true).c_str(), z->start,
+             z->start + z->size, z->failures, z->samples,
+             z->averageTime() * 1e-3);
+    }
+  }
+  const char * v = verdict(bad, time);
+  printf(" verdict: %s (%s)\n", v, strategy(v));
+}
+
+void Triage::writeJSONReport(const char * fileName)
+{
+  FILE * out = fopen(fileName, "w");
+  if(! out) {
+    std::string err = "Could not open report file '";
+    err += fileName;
+    err += "': ";
+    err += strerror(errno);
+    throw std::runtime_error(err);
+  }
+  long samples = 0;
+  for(int i = 0; i < zones.size(); i++)
+    samples += zones[i].samples;
+  double bad, time;
+  estimates(&bad, &time);
+  const char * v = verdict(bad, time);
+  fprintf(out, "{\n\"samples\": %ld,\n\"zones\": %d,\n\"sectors\": %ld,\n"
+          "\"bad_fraction\": %g,\n\"copy_time_s\": %.1f,\n"
+          "\"stuck\": %s,\n\"verdict\": \"%s\",\n\"strategy\": \"%s\",\n"
+          "\"slow_zones\": [",
+          samples, (int) zones.size(), totalSectors, bad, time,
+          stuck ? "true" : "false", v, strategy(v));
+  std::vector<TriageZone> slow = slowZones();
+  for(int i = 0; i < slow.size(); i++) {
+    const TriageZone * z = &slow[i];
+    fprintf(out, "%s\n  {\"file\": %s, \"start\": %d, \"end\": %d, "
+            "\"samples\": %d, \"failures\": %d, \"average_us\": %.0f}",
+            i ? "," : "", EventStream::quote(z->file->fileName(true)).c_str(),
+            z->start, z->start + z->size, z->samples, z->failures,
+            z->averageTime());
+  }
+  fprintf(out, "\n]\n}\n");
+  fclose(out);
+}
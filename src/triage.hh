@@ -0,0 +1,151 @@
+/**
+    \file triage.hh
+    The Triage class, a quick estimate of the damage of a disc
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __TRIAGE_H
+#define __TRIAGE_H
+
+#include <atomic>
+#include <mutex>
+
+class DVDFileData;
+
+/// A zone of a file sampled by Triage
+class TriageZone {
+public:
+  /// The file
+  const DVDFileData * file;
+
+  /// The first sector of the zone in the file, and the number of
+  /// sectors
+  int start, size;
+
+  /// The number of samples taken in the zone, and of those that
+  /// failed
+  int samples, failures;
+
+  /// The total time spent on the samples, and on those that failed,
+  /// in microseconds
+  long sampleTime, failureTime;
+
+  /// The number of streaming reads that succeeded, and the time
+  /// they took, in microseconds
+  int streamReads;
+  long streamTime;
+
+  TriageZone(const DVDFileData * f, int s, int n) :
+    file(f), start(s), size(n), samples(0), failures(0), sampleTime(0),
+    failureTime(0), streamReads(0), streamTime(0) {;};
+
+  /// The estimated fraction of bad sectors in the zone
+  double badFraction() const;
+
+  /// The average time of the samples, in microseconds
+  double averageTime() const;
+};
+
+/// Reads a sparse sample of sectors across all the titlesets of a
+/// disc, within a time budget, to estimate how damaged it is before
+/// committing a drive to copying it.
+///
+/// The VOB files are cut into zones (in proportion to their size),
+/// and each round reads one sample in each zone, in disc order,
+/// until the budget is spent. A sample is two consecutive reads of
+/// an ECC block: the first one tells whether the area is readable,
+/// the second one, which doesn't need a seek, the reading speed.
+///
+/// A watchdog thread gives up on reads that block for too long: it
+/// then displays the verdict so far, which is that the disc is
+/// hopeless, and terminates the program, as such reads can't be
+/// interrupted.
+class Triage {
+public:
+
+  /// The verdicts, as exit status of dvdcopy: they are distinct from
+  /// 1, the status of errors.
+  enum Verdict {
+    Pristine = 0,
+    Damaged = 10,
+    Hopeless = 11
+  };
+
+private:
+
+  /// The files of the source
+  std::vector<std::unique_ptr<DVDFileData> > files;
+
+  /// The zones, in disc order
+  std::vector<TriageZone> zones;
+
+  /// Protects the zones, which the watchdog reports on while the
+  /// sampling goes on, and the terminal
+  std::mutex mutex;
+
+  /// The total number of sectors of the zones
+  long totalSectors;
+
+  /// The time at which the current read started, or 0 when not
+  /// reading, in microseconds
+  std::atomic<long> readStart;
+
+  /// Set when the sampling is over, to stop the watchdog
+  std::atomic<bool> finished;
+
+  /// Waits for reads that block for more than stuckTime.
+  void watchdog();
+
+  /// Whether a read blocked longer than stuckTime
+  std::atomic<bool> stuck;
+
+  /// The verdict, from the estimates
+  const char * verdict(double badFraction, double copyTime) const;
+
+  /// The estimated fraction of bad sectors, and the estimated time to
+  /// copy the whole disc, in seconds
+  void estimates(double * badFraction, double * copyTime) const;
+
+  /// The zones that are much slower than the rest of the disc, or
+  /// with failed reads, adjacent ones being merged.
+  std::vector<TriageZone> slowZones() const;
+
+public:
+
+  Triage();
+
+  /// Samples the given source, and returns the verdict.
+  Verdict run(const char * source);
+
+  /// Displays the estimates
+  void displayReport();
+
+  /// Writes the estimates in JSON format
+  void writeJSONReport(const char * file);
+
+  /// The time budget, in seconds
+  double budget;
+
+  /// How long a single read can take before the watchdog gives up,
+  /// in seconds
+  double stuckTime;
+
+  /// If not empty, the file in which the estimates are written in
+  /// JSON format
+  std::string reportFile;
+};
+
+#endif
@@ -0,0 +1,162 @@
+/**
+    \file writerpool.cc
+    Implementation of the WriterPool class
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "headers.hh"
+#include "writerpool.hh"
+#include "readstats.hh"
+#include "trace.hh"
+
+#include <unistd.h>
+
+WriterPool::WriterPool(size_t cap) :
+  lastServed(-1), memoryCap(cap), queued(0), chunkSize(4*1024*1024),
+  stopping(false)
+{
+  if(chunkSize > memoryCap)
+    chunkSize = memoryCap;
+  thread = std::thread(&WriterPool::writerThread, this);
+}
+
+WriterChannel * WriterPool::addChannel(const std::string & name)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  channels.push_back(new WriterChannel(name));
+  return channels.back();
+}
+
+void WriterPool::checkError(WriterChannel * channel)
+{
+  if(! channel->error.empty()) {
+    std::string err = channel->error;
+    channel->error.clear();
+    throw std::runtime_error(err);
+  }
+}
+
+void WriterPool::write(WriterChannel * channel, int fd, off_t offset,
+                       const char * data, size_t size)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  checkError(channel);
+
+  // A write larger than the cap is let through when nothing else is
+  // queued, else it would wait forever.
+  if(queued > 0 && queued + size > memoryCap) {
+    long before = ReadStatistics::timestamp();
+    while(queued > 0 && queued + size > memoryCap)
+      dataWritten.wait(lock);
+    channel->waitTime += ReadStatistics::timestamp() - before;
+  }
+
+  if(! channel->chunks.empty()) {
+    WriterChannel::Chunk & last = channel->chunks.back();
+    if(last.fd == fd && last.offset + (off_t)last.data.size() == offset &&
+       last.data.size() + size <= chunkSize) {
+      last.data.insert(last.data.end(), data, data + size);
+      queued += size;
+      return;
+    }
+  }
+  channel->chunks.push_back(WriterChannel::Chunk());
+  WriterChannel::Chunk & chunk = channel->chunks.back();
+  chunk.fd = fd;
+  chunk.offset = offset;
+  chunk.data.assign(data, data + size);
+  queued += size;
+  dataQueued.notify_one();
+}
+
+void WriterPool::flush(WriterChannel * channel)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(channel->busy || ! channel->chunks.empty())
+    dataWritten.wait(lock);
+  checkError(channel);
+}
+
+void WriterPool::writerThread()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    // Serve the channels in turn
+    WriterChannel * channel = NULL;
+    for(int i = 1; i <= channels.size(); i++) {
+      int idx = (lastServed + i) % channels.size();
+      if(! channels[idx]->chunks.empty()) {
+        channel = channels[idx];
+        lastServed = idx;
+        break;
+      }
+    }
+    if(! channel) {
+      if(stopping)
+        return;
+      dataQueued.wait(lock);
+      continue;
+    }
+
+    WriterChannel::Chunk chunk;
+    std::swap(chunk, channel->chunks.front());
+    channel->chunks.pop_front();
+    channel->busy = true;
+    lock.unlock();
+
+    std::string error;
+    long before = ReadStatistics::timestamp();
+    {
+      TRACE_SPAN("poolWrite");
+      size_t done = 0;
+      while(done < chunk.data.size()) {
+        ssize_t nb = pwrite(chunk.fd, &chunk.data[done],
+                            chunk.data.size() - done, chunk.offset + done);
+        if(nb < 0) {
+          if(errno == EINTR)
+            continue;
+          error = "Write error: ";
+          error += strerror(errno);
+          break;
+        }
+        done += nb;
+      }
+    }
+    long duration = ReadStatistics::timestamp() - before;
+
+    lock.lock();
+    channel->busy = false;
+    channel->writes += 1;
+    channel->bytes += chunk.data.size();
+    channel->writeTime += duration;
+    if(! error.empty() && channel->error.empty())
+      channel->error = error;
+    queued -= chunk.data.size();
+    dataWritten.notify_all();
+  }
+}
+
+WriterPool::~WriterPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  dataQueued.notify_one();
+  thread.join();
+  for(int i = 0; i < channels.size(); i++)
+    delete channels[i];
+}
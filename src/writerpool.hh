@@ -0,0 +1,140 @@
+/**
+    \file writerpool.hh
+    The WriterPool class, that writes the output of several copies
+    Copyright 2026 by Vincent Fourmond
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __WRITERPOOL_H
+#define __WRITERPOOL_H
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include <sys/types.h>
+
+/// A queue of writes to a WriterPool, one for each copy.
+class WriterChannel {
+  friend class WriterPool;
+
+  /// A piece of data to be written at a given position
+  class Chunk {
+  public:
+    int fd;
+    off_t offset;
+    std::vector<char> data;
+  };
+
+  /// The name, for the report
+  std::string name;
+
+  /// The chunks waiting to be written
+  std::deque<Chunk> chunks;
+
+  /// Whether the first chunk is being written
+  bool busy;
+
+  /// The first write error, if any
+  std::string error;
+
+public:
+  /// Number of write calls, bytes written and time spent writing
+  /// (in microseconds)
+  long writes, bytes, writeTime;
+
+  /// Time spent waiting for room in the pool (in microseconds)
+  long waitTime;
+
+  WriterChannel(const std::string & n) :
+    name(n), busy(false), writes(0), bytes(0), writeTime(0),
+    waitTime(0) {;};
+
+  const std::string & channelName() const { return name; };
+};
+
+/// Writes the data of several concurrent copies to disk from a
+/// single thread.
+///
+/// Each copy writes through its own WriterChannel. Consecutive
+/// writes to the same file are coalesced into large chunks, channels
+/// are served in turn so that no copy starves the others, and the
+/// amount of data waiting to be written is capped: writers block
+/// when the cap is reached. This way, the output disk sees a few
+/// large sequential writes instead of many small interleaved ones.
+class WriterPool {
+  /// The channels, owned by this object
+  std::vector<WriterChannel *> channels;
+
+  /// The channel served last
+  int lastServed;
+
+  /// The maximum amount of data waiting to be written
+  size_t memoryCap;
+
+  /// The current amount of data waiting to be written
+  size_t queued;
+
+  /// The size above which chunks are not coalesced anymore
+  size_t chunkSize;
+
+  /// Whether the writer thread should stop
+  bool stopping;
+
+  std::mutex mutex;
+
+  /// Signalled when data is queued
+  std::condition_variable dataQueued;
+
+  /// Signalled when data was written
+  std::condition_variable dataWritten;
+
+  std::thread thread;
+
+  /// The writer thread
+  void writerThread();
+
+  /// Throws if there was a write error on the channel. Must be
+  /// called with the mutex held.
+  static void checkError(WriterChannel * channel);
+
+public:
+
+  /// Creates a pool holding at most @a cap bytes of data waiting to
+  /// be written.
+  WriterPool(size_t cap);
+
+  /// Creates a new channel
+  WriterChannel * addChannel(const std::string & name);
+
+  /// Queues @a size bytes of @a data to be written at @a offset in
+  /// @a fd. It blocks when the pool is full.
+  void write(WriterChannel * channel, int fd, off_t offset,
+             const char * data, size_t size);
+
+  /// Waits until all the data of the channel is written. It must be
+  /// called before closing the file descriptors used by the channel.
+  void flush(WriterChannel * channel);
+
+  /// Returns all the channels
+  const std::vector<WriterChannel *> & allChannels() const {
+    return channels;
+  };
+
+  /// Writes out all the pending data and stops the writer thread.
+  ~WriterPool();
+};
+
+#endif